@@ -0,0 +1,397 @@
+#include "ttp.h"
+#include "instance.h"
+#include <argp.h>
+#include <glob.h>
+#include <string.h>
+#include <time.h>
+
+enum {ERR_USAGE = 1, ERR_FILENAME, ERR_REGRESSION, ERR_SCANS};
+
+#define MAX_RESULTS	1024
+// starting weight of the macrobenchmarks, and the one moves are evaluated at
+#define BENCH_WEIGHT	4000
+// seconds each macrobenchmark solve is given
+#define BENCH_SECONDS	0.5
+
+// team counts of the generated instances the microbenchmarks scale up to
+static const int SCALE_TEAMS[] = {32, 64, MAX_TEAMS};
+// generated instances up to this many teams have their scans checked too, so
+// every count of teams past the last full vector is
+#define CHECK_MAX_TEAMS	40
+// schedules the scans are checked on for each instance, and moves made on
+// each, checking every CHECK_EVERY
+#define CHECK_SEEDS		3
+#define CHECK_MOVES		1000
+#define CHECK_EVERY		100
+
+const char *argp_program_version =
+	"rdb-ttp-bench v1.0";
+const char *argp_program_bug_address =
+	"<rsardb11@vt.edu>";
+/* Program documentation */
+static char doc[] =
+	"rdb-ttp-bench -- benchmarks for rdb-ttp\n"
+	"Results are written as CSV lines of benchmark,instance,metric,value,better "
+	"where better is lower or higher. The SIMD scans are checked against the "
+	"scalar ones on every instance first, failing if they differ";
+
+static struct argp_option options[] = {
+	{ "output", 'o', "file", 0, "File to write results to (default stdout)" },
+	{ "baseline", 'b', "file", 0, "Compare against results from a previous run" },
+	{ "threshold", 't', "percent", 0, "Percent worse than the baseline that counts "
+			"as a regression (default 10)" },
+	{ "calls", 'n', "calls", 0, "Calls per move for the microbenchmarks (default 100000)" },
+	{ "seeds", 's', "seeds", 0, "Seeds per instance for the macrobenchmarks (default 3)" },
+	{ 0 }
+};
+
+struct arguments {
+	char *output, *baseline;
+	double threshold;
+	unsigned calls, seeds;
+};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+	struct arguments *args = state->input;
+	char *ptr;
+	switch(key) {
+		case 'o':
+			args->output = arg;
+			break;
+		case 'b':
+			args->baseline = arg;
+			break;
+		case 't':
+			args->threshold = strtod(arg, &ptr);
+			if (ptr == arg || args->threshold < 0) {
+				printf("Error: Threshold must be a positive float\n");
+				return ERR_USAGE;
+			}
+			break;
+		case 'n':
+			args->calls = strtoul(arg, &ptr, 10);
+			if (ptr == arg || args->calls == 0) {
+				printf("Error: Calls must be a positive integer\n");
+				return ERR_USAGE;
+			}
+			break;
+		case 's':
+			args->seeds = strtoul(arg, &ptr, 10);
+			if (ptr == arg || args->seeds == 0) {
+				printf("Error: Seeds must be a positive integer\n");
+				return ERR_USAGE;
+			}
+			break;
+		case ARGP_KEY_ARG:
+			argp_usage(state);
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static struct argp argp = { options, parse_opt, 0, doc };
+
+// A single measurement
+typedef struct {
+	char benchmark[16];
+	char instance[16];
+	char metric[32];
+	double value;
+	bool lower;
+} Result;
+
+static Result RESULTS[MAX_RESULTS];
+static int NUM_RESULTS;
+
+static void AddResult(char *benchmark, char *instance, char *metric, \
+		double value, bool lower) {
+	if (NUM_RESULTS == MAX_RESULTS) {
+		return;
+	}
+	Result *r = &RESULTS[NUM_RESULTS++];
+	snprintf(r->benchmark, sizeof(r->benchmark), "%s", benchmark);
+	snprintf(r->instance, sizeof(r->instance), "%s", instance);
+	snprintf(r->metric, sizeof(r->metric), "%s", metric);
+	r->value = value;
+	r->lower = lower;
+}
+
+static double __Seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// a generated schedule with its costs, ready for moves
+static Schedule *BenchSchedule(Schedule *distance, unsigned seed) {
+	Schedule *s = CloneSchedule(distance);
+	SeedSchedule(s, seed);
+	StartSchedule(s, GEN_AUTO);
+	ComputeCost(s);
+	InitViolations(s);
+	return s;
+}
+
+// ns per call for each move and its evaluation, ComputeCost and CheckSoftReq
+static void Micro(Schedule *distance, char *instance, unsigned calls) {
+	char metric[32];
+	Move *moves = calloc(calls, sizeof(*moves));
+	for (int f = 0; f < NUM_MOVES; f++) {
+		Schedule *s = BenchSchedule(distance, 0);
+		// pick the moves up front so only the move is timed
+		for (int i = 0; i < calls; i++) {
+			RandomMove(s, &moves[i]);
+			moves[i].type = f;
+		}
+		MoveDelta d;
+		double start = __Seconds();
+		for (int i = 0; i < calls; i++) {
+			EvaluateMove(s, &moves[i], BENCH_WEIGHT, &d);
+		}
+		snprintf(metric, sizeof(metric), "%s_eval_ns", MOVE_NAMES[f]);
+		AddResult("micro", instance, metric, ((__Seconds() - start) * 1e9) / calls, true);
+		start = __Seconds();
+		for (int i = 0; i < calls; i++) {
+			ApplyMove(s, &moves[i]);
+		}
+		double elapsed = __Seconds() - start;
+		snprintf(metric, sizeof(metric), "%s_ns", MOVE_NAMES[f]);
+		AddResult("micro", instance, metric, (elapsed * 1e9) / calls, true);
+		DeleteSchedule(s);
+	}
+	free(moves);
+
+	Schedule *s = BenchSchedule(distance, 0);
+	unsigned scans = calls / 10 + 1;
+	double start = __Seconds();
+	for (int i = 0; i < scans; i++) {
+		ComputeCost(s);
+	}
+	AddResult("micro", instance, "ComputeCost_ns", \
+			((__Seconds() - start) * 1e9) / scans, true);
+	int nbv = 0;
+	start = __Seconds();
+	for (int i = 0; i < scans; i++) {
+		CheckSoftReq(s, &nbv);
+	}
+	AddResult("micro", instance, "CheckSoftReq_ns", \
+			((__Seconds() - start) * 1e9) / scans, true);
+	DeleteSchedule(s);
+}
+
+// check the SIMD scans against the scalar ones, on schedules of CHECK_SEEDS
+// seeds as they are moved about
+// returns false if they differ
+static bool Check(Schedule *distance, char *instance) {
+	bool same = true;
+	for (unsigned seed = 0; seed < CHECK_SEEDS && same; seed++) {
+		Schedule *s = BenchSchedule(distance, seed);
+		for (int i = 0; i <= CHECK_MOVES && same; i++) {
+			if (i % CHECK_EVERY == 0) {
+				same = CheckScans(s);
+			}
+			Move m;
+			RandomMove(s, &m);
+			ApplyMove(s, &m);
+		}
+		DeleteSchedule(s);
+	}
+	if (!same) {
+		printf("Scans differ on %s\n", instance);
+	}
+	return same;
+}
+
+// iterations per second and best cost of solves given BENCH_SECONDS each
+static void Macro(char *benchmark, Schedule *distance, char *instance, unsigned seeds, \
+		Settings settings) {
+	unsigned long moves = 0, best = 0;
+	int valid = 0;
+	double elapsed = 0;
+	for (unsigned seed = 0; seed < seeds; seed++) {
+		Schedule *s = CloneSchedule(distance);
+		double start = __Seconds();
+		int invalid = Solve(s, seed, settings);
+		elapsed += __Seconds() - start;
+		moves += s->num_moves;
+		if (!invalid) {
+			if (!valid || s->cost.total_cost < best) {
+				best = s->cost.total_cost;
+			}
+			valid++;
+		}
+		DeleteSchedule(s);
+	}
+	AddResult(benchmark, instance, "iterations_per_sec", moves / elapsed, false);
+	AddResult(benchmark, instance, "valid_runs", valid, false);
+	// no cost to compare if every run was invalid, valid_runs shows that
+	if (valid) {
+		AddResult(benchmark, instance, "best_cost", best, true);
+	}
+}
+
+// compare results to a baseline, returns the number of regressions
+// results missing from the baseline, or 0 in it, can't be compared and
+// are only listed, and ones in the baseline no longer measured regress
+static int Compare(char *baseline, double threshold) {
+	FILE *fptr = fopen(baseline, "r");
+	if (fptr == NULL) {
+		printf("Unable to read file %s\n", baseline);
+		return -1;
+	}
+	int regressions = 0;
+	bool compared[MAX_RESULTS] = {false};
+	char line[256];
+	printf("%-10s%-10s%-28s%16s%16s%10s\n", "bench", "inst", "metric", \
+			"baseline", "current", "change");
+	while (fgets(line, sizeof(line), fptr)) {
+		Result base;
+		char better[8];
+		if (sscanf(line, "%15[^,],%15[^,],%31[^,],%lf,%7s", base.benchmark, \
+				base.instance, base.metric, &base.value, better) != 5) {
+			continue;
+		}
+		int i;
+		for (i = 0; i < NUM_RESULTS; i++) {
+			Result *r = &RESULTS[i];
+			if (strcmp(r->benchmark, base.benchmark) || strcmp(r->instance, base.instance) \
+					|| strcmp(r->metric, base.metric)) {
+				continue;
+			}
+			compared[i] = true;
+			if (!base.value) {
+				printf("%-10s%-10s%-28s%16.2f%16.2f%10s\n", r->benchmark, \
+						r->instance, r->metric, base.value, r->value, "n/a");
+				break;
+			}
+			double change = ((r->value - base.value) / base.value) * 100;
+			double worse = (r->lower) ? change : -change;
+			bool regressed = worse > threshold;
+			regressions += regressed;
+			printf("%-10s%-10s%-28s%16.2f%16.2f%+9.1f%%%s\n", r->benchmark, \
+					r->instance, r->metric, base.value, r->value, change, \
+					(regressed) ? "  REGRESSION" : "");
+			break;
+		}
+		if (i == NUM_RESULTS) {
+			regressions++;
+			printf("%-10s%-10s%-28s%16.2f%16s%10s  REGRESSION\n", base.benchmark, \
+					base.instance, base.metric, base.value, "-", "missing");
+		}
+	}
+	fclose(fptr);
+	for (int i = 0; i < NUM_RESULTS; i++) {
+		if (!compared[i]) {
+			Result *r = &RESULTS[i];
+			printf("%-10s%-10s%-28s%16s%16.2f%10s\n", r->benchmark, r->instance, \
+					r->metric, "-", r->value, "n/a");
+		}
+	}
+	return regressions;
+}
+
+int main(int argc, char **argv) {
+	struct arguments arguments;
+	int retval;
+	arguments.output = NULL;
+	arguments.baseline = NULL;
+	arguments.threshold = 10;
+	arguments.calls = 100000;
+	arguments.seeds = 3;
+	if ((retval = argp_parse(&argp, argc, argv, 0, 0, &arguments))) {
+		return retval;
+	}
+
+	// a fixed time budget, so best_cost is the cost reached in that time
+	// the default schedule runs far longer, only small instances finish early
+	// by reaching the lower bound
+	Settings settings;
+	TtpDefaultSettings(&settings);
+	settings.weight = BENCH_WEIGHT;
+	settings.time_limit = BENCH_SECONDS;
+	settings.generator = GEN_BACKTRACK;
+	settings.checkpoint_every = 0;
+
+	bool scans_same = true;
+	for (int n = 4; n <= CHECK_MAX_TEAMS; n += 2) {
+		char instance[16];
+		snprintf(instance, sizeof(instance), "EUCLID%d", n);
+		Instance *inst = MakeInstance(INST_EUCLID, n, 0);
+		Schedule *distance = CreateScheduleShared(inst->num_teams, inst->distance);
+		scans_same &= Check(distance, instance);
+		DeleteSchedule(distance);
+		DeleteInstance(inst);
+	}
+
+	glob_t files;
+	if (glob("data/NL*.data", 0, NULL, &files)) {
+		printf("Unable to find any instances in data/\n");
+		return ERR_FILENAME;
+	}
+	for (int i = 0; i < files.gl_pathc; i++) {
+		int num_teams;
+		char instance[16];
+		if (sscanf(files.gl_pathv[i], "data/NL%d.data", &num_teams) != 1) {
+			continue;
+		}
+		snprintf(instance, sizeof(instance), "NL%d", num_teams);
+		Instance *inst = LoadInstance(files.gl_pathv[i], false);
+		if (inst == NULL) {
+			printf("Unable to read file %s\n", files.gl_pathv[i]);
+			continue;
+		}
+		Schedule *distance = CreateScheduleShared(inst->num_teams, inst->distance);
+		fprintf(stderr, "%s\n", instance);
+		scans_same &= Check(distance, instance);
+		Micro(distance, instance, arguments.calls);
+		Macro("macro", distance, instance, arguments.seeds, settings);
+		Settings adaptive = settings;
+		adaptive.policy = POLICY_ADAPTIVE;
+		Macro("adaptive", distance, instance, arguments.seeds, adaptive);
+		DeleteSchedule(distance);
+		DeleteInstance(inst);
+	}
+	globfree(&files);
+	// how moves and scans grow past the bundled instances
+	for (int i = 0; i < sizeof(SCALE_TEAMS) / sizeof(*SCALE_TEAMS); i++) {
+		char instance[16];
+		snprintf(instance, sizeof(instance), "EUCLID%d", SCALE_TEAMS[i]);
+		Instance *inst = MakeInstance(INST_EUCLID, SCALE_TEAMS[i], 0);
+		Schedule *distance = CreateScheduleShared(inst->num_teams, inst->distance);
+		fprintf(stderr, "%s\n", instance);
+		scans_same &= Check(distance, instance);
+		Micro(distance, instance, arguments.calls);
+		DeleteSchedule(distance);
+		DeleteInstance(inst);
+	}
+
+	FILE *out = stdout;
+	if (arguments.output && (out = fopen(arguments.output, "w")) == NULL) {
+		printf("Unable to write file %s\n", arguments.output);
+		return ERR_FILENAME;
+	}
+	for (int i = 0; i < NUM_RESULTS; i++) {
+		fprintf(out, "%s,%s,%s,%f,%s\n", RESULTS[i].benchmark, RESULTS[i].instance, \
+				RESULTS[i].metric, RESULTS[i].value, (RESULTS[i].lower) ? "lower" : "higher");
+	}
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	if (!scans_same) {
+		return ERR_SCANS;
+	}
+	if (arguments.baseline) {
+		int regressions = Compare(arguments.baseline, arguments.threshold);
+		if (regressions < 0) {
+			return ERR_FILENAME;
+		} else if (regressions) {
+			printf("%d regressions of more than %.1f%%\n", regressions, \
+					arguments.threshold);
+			return ERR_REGRESSION;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,134 @@
+#include "bound.h"
+#include <limits.h>
+
+// distance from team a's venue to team b's
+static inline unsigned long __Dist(Schedule *s, int a, int b) {
+	return s->cost.distance[((a - 1) * s->num_teams) + (b - 1)];
+}
+
+// cheapest way to cover set, as the trip through venues in, which holds the
+// lowest venue of set, plus up to left more venues of rest, followed by the
+// cheapest tour of whatever is left
+static void __CoverSet(const unsigned long *trip, const unsigned long *tour, \
+		uint32_t set, uint32_t in, uint32_t rest, int left, unsigned long *best) {
+	unsigned long cost = trip[in] + tour[set & ~in];
+	if (cost < *best) {
+		*best = cost;
+	}
+	for (; left && rest; rest &= rest - 1) {
+		uint32_t bit = rest & -rest;
+		__CoverSet(trip, tour, set, in | bit, rest & (rest - 1), left - 1, best);
+	}
+}
+
+// cheapest tour for team t over every subset of the other venues
+// the venues are the bits of a subset, so this is only for small instances
+static unsigned long __ExactBound(Schedule *s, int t) {
+	int m = s->num_teams - 1;
+	uint32_t full = (1u << m) - 1;
+	int venue[BOUND_EXACT_TEAMS];
+	for (int i = 1, j = 0; i <= s->num_teams; i++) {
+		if (i != t) {
+			venue[j++] = i;
+		}
+	}
+	// cheapest path from home through each set of at most ATMOST venues,
+	// ending at each venue of the set
+	unsigned long *path = malloc(((size_t) full + 1) * m * sizeof(*path));
+	// cheapest trip from home through each set of at most ATMOST venues
+	unsigned long *trip = malloc(((size_t) full + 1) * sizeof(*trip));
+	// cheapest tour through each set, any number of trips
+	unsigned long *tour = malloc(((size_t) full + 1) * sizeof(*tour));
+
+	for (uint32_t set = 1; set <= full; set++) {
+		trip[set] = ULONG_MAX;
+		if (__builtin_popcount(set) > ATMOST) {
+			continue;
+		}
+		for (uint32_t last = set; last; last &= last - 1) {
+			int j = __builtin_ctz(last);
+			uint32_t prev = set & ~(1u << j);
+			unsigned long best = (prev) ? ULONG_MAX : __Dist(s, t, venue[j]);
+			for (uint32_t from = prev; from; from &= from - 1) {
+				int i = __builtin_ctz(from);
+				unsigned long cost = path[(prev * m) + i] + __Dist(s, venue[i], venue[j]);
+				if (cost < best) {
+					best = cost;
+				}
+			}
+			path[(set * m) + j] = best;
+			if (best + __Dist(s, venue[j], t) < trip[set]) {
+				trip[set] = best + __Dist(s, venue[j], t);
+			}
+		}
+	}
+
+	tour[0] = 0;
+	for (uint32_t set = 1; set <= full; set++) {
+		uint32_t first = set & -set;
+		tour[set] = ULONG_MAX;
+		__CoverSet(trip, tour, set, first, set & ~first, ATMOST - 1, &tour[set]);
+	}
+	unsigned long bound = tour[full];
+	free(tour);
+	free(trip);
+	free(path);
+	return bound;
+}
+
+// cheapest way into each team's venue from any other into in
+static void __CheapestIn(Schedule *s, unsigned long *in) {
+	for (int v = 1; v <= s->num_teams; v++) {
+		in[v] = ULONG_MAX;
+		for (int u = 1; u <= s->num_teams; u++) {
+			if (u != v && __Dist(s, u, v) < in[v]) {
+				in[v] = __Dist(s, u, v);
+			}
+		}
+	}
+}
+
+// bound for team t from the cheapest way into each venue, as every other
+// venue is entered once and home at least once for every ATMOST of them
+static unsigned long __QuickBound(Schedule *s, int t, const unsigned long *in) {
+	unsigned long bound = 0, home = ULONG_MAX;
+	for (int v = 1; v <= s->num_teams; v++) {
+		if (v == t) {
+			continue;
+		}
+		bound += in[v];
+		if (__Dist(s, v, t) < home) {
+			home = __Dist(s, v, t);
+		}
+	}
+	return bound + (home * ((s->num_teams - 1 + ATMOST - 1) / ATMOST));
+}
+
+unsigned long TeamLowerBound(Schedule *s, int t) {
+	if (s->num_teams <= BOUND_EXACT_TEAMS) {
+		return __ExactBound(s, t);
+	}
+	unsigned long *in = calloc(s->num_teams + 1, sizeof(*in));
+	__CheapestIn(s, in);
+	unsigned long bound = __QuickBound(s, t, in);
+	free(in);
+	return bound;
+}
+
+unsigned long LowerBound(Schedule *s) {
+	unsigned long bound = 0;
+	if (s->num_teams <= BOUND_EXACT_TEAMS) {
+		for (int t = 1; t <= s->num_teams; t++) {
+			bound += __ExactBound(s, t);
+		}
+		return bound;
+	}
+	// worked out once for every team
+	unsigned long *in = calloc(s->num_teams + 1, sizeof(*in));
+	__CheapestIn(s, in);
+	for (int t = 1; t <= s->num_teams; t++) {
+		bound += __QuickBound(s, t, in);
+	}
+	free(in);
+	return bound;
+}
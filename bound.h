@@ -0,0 +1,19 @@
+#ifndef BOUND_H
+#define BOUND_H
+
+#include "ttp.h"
+
+// Lower bounds on the travel distance of any schedule of an instance
+// Each team's tour is at best the cheapest way to visit every other venue
+// from home, in trips of at most ATMOST away games. The sum of those is
+// the independent lower bound, found exactly for up to BOUND_EXACT_TEAMS
+// teams. Above that each team's bound is only the cheapest way into each
+// venue and back home often enough, which is quick but looser.
+#define BOUND_EXACT_TEAMS	16
+
+// Lower bound on the travel distance of team t
+unsigned long TeamLowerBound(Schedule *s, int t);
+// Lower bound on the total travel distance, the sum over every team
+unsigned long LowerBound(Schedule *s);
+
+#endif /* BOUND_H */
@@ -0,0 +1,126 @@
+#include "ttp.h"
+#include "instance.h"
+
+struct TtpContext {
+	// holds the distances, never solved, each result is cloned from it
+	Schedule *base;
+	// schedule of the last solve, NULL before the first
+	Schedule *s;
+	// loaded by TtpLoad and deleted with the context, else NULL
+	Instance *inst;
+	const char *const *names;
+};
+
+void TtpDefaultSettings(Settings *settings) {
+	settings->temp = 400;
+	settings->beta = 0.9999;
+	settings->weight = 4000;
+	settings->theta = settings->delta = 1.04;
+	settings->max_reheat = 10;
+	settings->max_phase = 7100;
+	settings->max_counter = 5000;
+	settings->replicas = 0;
+	settings->generator = GEN_AUTO;
+	settings->policy = POLICY_UNIFORM;
+	settings->update = false;
+	settings->checkpoint = NULL;
+	settings->checkpoint_every = 60;
+	settings->time_limit = 0;
+	settings->progress = NULL;
+	settings->progress_data = NULL;
+	settings->trace = NULL;
+	settings->trace_every = 10000;
+	settings->gap = 0;
+}
+
+TtpContext *TtpLoad(char *filename, bool cache) {
+	Instance *inst = LoadInstance(filename, cache);
+	if (inst == NULL) {
+		return NULL;
+	} else if (inst->num_teams < 4 || inst->num_teams % 2 || inst->num_teams > MAX_TEAMS) {
+		DeleteInstance(inst);
+		return NULL;
+	}
+	TtpContext *ctx = TtpCreate(inst->num_teams, inst->distance, \
+			(const char *const *) inst->names);
+	ctx->inst = inst;
+	return ctx;
+}
+
+TtpContext *TtpCreate(int num_teams, int *distance, const char *const *names) {
+	TtpContext *ctx = calloc(1, sizeof(*ctx));
+	ctx->base = CreateScheduleShared(num_teams, distance);
+	ctx->names = names;
+	return ctx;
+}
+
+TtpContext *TtpClone(TtpContext *ctx) {
+	TtpContext *clone = calloc(1, sizeof(*clone));
+	clone->base = CloneSchedule(ctx->base);
+	clone->names = ctx->names;
+	return clone;
+}
+
+void TtpDelete(TtpContext *ctx) {
+	if (ctx->s) {
+		DeleteSchedule(ctx->s);
+	}
+	DeleteSchedule(ctx->base);
+	if (ctx->inst) {
+		DeleteInstance(ctx->inst);
+	}
+	free(ctx);
+}
+
+// a fresh schedule for the next result, and the settings to solve it with
+static Settings __StartResult(TtpContext *ctx, const Settings *settings, \
+		Progress progress, void *data) {
+	if (ctx->s) {
+		DeleteSchedule(ctx->s);
+	}
+	ctx->s = CloneSchedule(ctx->base);
+	Settings copy = *settings;
+	copy.progress = progress;
+	copy.progress_data = data;
+	return copy;
+}
+
+int TtpSolve(TtpContext *ctx, unsigned seed, const Settings *settings, \
+		Progress progress, void *data) {
+	Settings copy = __StartResult(ctx, settings, progress, data);
+	return Solve(ctx->s, seed, copy);
+}
+
+int TtpResume(TtpContext *ctx, char *filename, const Settings *settings, \
+		Progress progress, void *data) {
+	Settings copy = __StartResult(ctx, settings, progress, data);
+	return Resume(ctx->s, filename, copy);
+}
+
+int TtpNumTeams(TtpContext *ctx) {
+	return ctx->base->num_teams;
+}
+
+int TtpNumRounds(TtpContext *ctx) {
+	return ctx->base->num_rounds;
+}
+
+const char *TtpTeamName(TtpContext *ctx, int t) {
+	return (ctx->names) ? ctx->names[t - 1] : NULL;
+}
+
+unsigned long TtpLowerBound(TtpContext *ctx) {
+	return ctx->base->cost.lower_bound;
+}
+
+unsigned long TtpCost(TtpContext *ctx) {
+	return (ctx->s) ? ctx->s->cost.total_cost : 0;
+}
+
+int TtpOpponent(TtpContext *ctx, int r, int t) {
+	return (ctx->s) ? SLOT(ctx->s, r, t) : 0;
+}
+
+Schedule *TtpSchedule(TtpContext *ctx) {
+	return ctx->s;
+}
@@ -0,0 +1,1173 @@
+#ifndef CORE_H
+#define CORE_H
+
+// The annealing core: moves, their cost and violation updates and the
+// annealing loop, shared by ttp.c and fixed.c
+// fixed.c compiles it again for each of FIXED_TEAM_COUNTS with FIXED_TEAMS
+// set, so the team and round counts are constants and every loop bound is
+// known to the compiler
+
+#include "ttp.h"
+#include "trace.h"
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <time.h>
+
+// team counts with a core of their own, must match FIXED_TEAMS in the Makefile
+#ifdef NO_FIXED
+#define FIXED_TEAM_COUNTS(X)
+#else
+#define FIXED_TEAM_COUNTS(X)	X(8) X(10) X(12) X(14) X(16)
+#endif
+
+#ifdef FIXED_TEAMS
+#define TEAMS(s)		FIXED_TEAMS
+#define ROUNDS(s)		((2 * FIXED_TEAMS) - 2)
+// rows padded to whole cache lines, as __CreateSchedule lays them out
+#ifdef TEAM_MAJOR
+#define FIXED_ROW_LEN	((2 * FIXED_TEAMS) - 2)
+#else
+#define FIXED_ROW_LEN	(FIXED_TEAMS + 1)
+#endif
+#define FIXED_STRIDE	((FIXED_ROW_LEN + CACHE_LINE_CELLS - 1) & ~(CACHE_LINE_CELLS - 1))
+#undef SLOT
+#ifdef TEAM_MAJOR
+#define SLOT(s, r, t)	((s)->slot[((t) * FIXED_STRIDE) + (s)->round[(r)]])
+#else
+#define SLOT(s, r, t)	((s)->slot[((s)->round[(r)] * FIXED_STRIDE) + (t)])
+#endif
+#else
+#define TEAMS(s)		((s)->num_teams)
+#define ROUNDS(s)		((s)->num_rounds)
+#endif
+
+// Instrumentation, compiled out unless built with STATS
+#ifdef STATS
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t __Cycles(void) {
+	return __rdtsc();
+}
+#else
+#include <time.h>
+// no cycle counter, count nanoseconds instead
+static inline uint64_t __Cycles(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+#endif
+#define STAT_START(v)			uint64_t v = __Cycles()
+#define STAT_CYCLES(s, field, v)	((s)->stats.field += __Cycles() - (v))
+#define STAT_INC(s, field)		((s)->stats.field++)
+#else
+#define STAT_START(v)
+#define STAT_CYCLES(s, field, v)
+#define STAT_INC(s, field)
+#endif
+
+// take n zeroed ints from the scratch stack
+static inline int *__ScratchGet(Schedule *s, int n) {
+	int *mem = s->scratch.mem + s->scratch.used;
+	s->scratch.used += n;
+	memset(mem, 0, n * sizeof(*mem));
+	return mem;
+}
+
+// give back the last n ints taken from the scratch stack
+static inline void __ScratchPut(Schedule *s, int n) {
+	s->scratch.used -= n;
+}
+
+// next random number from the schedule's own generator
+static inline uint32_t __Rand(Schedule *s) {
+	return __NextRand(&s->rng);
+}
+
+// random number from 0 to range - 1 without the bias of %
+// multiplies into the high 32 bits instead of dividing, only rejecting
+// the few values that would make some results more likely
+static inline uint32_t __RandRange(Schedule *s, uint32_t range) {
+	uint64_t m = (uint64_t) __Rand(s) * range;
+	uint32_t low = (uint32_t) m;
+	if (low < range) {
+		uint32_t threshold = -range % range;
+		while (low < threshold) {
+			m = (uint64_t) __Rand(s) * range;
+			low = (uint32_t) m;
+		}
+	}
+	return m >> 32;
+}
+
+// true with probability p
+static inline bool __Chance(Schedule *s, double p) {
+	return __Rand(s) * (1.0 / 4294967296.0) < p;
+}
+
+// copies a schedule from source to destination
+// requires both be initialized
+// if copy_costs is true, copy the cost table, else skip
+static inline void CopySchedule(Schedule *dst, Schedule *src, bool copy_costs) {
+	memcpy(dst->slot, src->slot, NUM_ROWS(src) * src->stride * sizeof(*(src->slot)));
+	memcpy(dst->round, src->round, ROUNDS(src) * sizeof(*(src->round)));
+	for (int i = 1; i <= TEAMS(src); i++) {
+		dst->cost.team_cost[i] = src->cost.team_cost[i];
+	}
+	dst->cost.total_cost = src->cost.total_cost;
+	for (int i = 1; i <= TEAMS(src); i++) {
+		dst->viol.team_nbv[i] = src->viol.team_nbv[i];
+	}
+	dst->viol.nbv = src->viol.nbv;
+	if (copy_costs) {
+		for (int i = 0; i < TEAMS(src) * TEAMS(src); i++) {
+			dst->cost.distance[i] = src->cost.distance[i];
+		}
+	}
+}
+
+// A team's games with the ones in rounds r_a and r_b replaced by val_a and
+// val_b, to see what a move would do to the team without making it
+// rounds of -1 replace nothing
+typedef struct {
+	int t;
+	int r_a, val_a;
+	int r_b, val_b;
+} TeamView;
+
+// team t's games as they are
+#define TEAM_VIEW(t)	((TeamView) {(t), -1, 0, -1, 0})
+
+// opponent of the viewed team in round r, negative if away
+static inline int __ViewSlot(Schedule *s, const TeamView *v, int r) {
+	if (r == v->r_a) {
+		return v->val_a;
+	} else if (r == v->r_b) {
+		return v->val_b;
+	}
+	return SLOT(s, r, v->t);
+}
+
+// location of the viewed team during round r, rounds outside the schedule
+// are at home
+static inline int __ViewLocation(Schedule *s, const TeamView *v, int r) {
+	if (r < 0 || r >= ROUNDS(s)) {
+		return v->t;
+	}
+	int opp = __ViewSlot(s, v, r);
+	return (opp > 0) ? v->t : -opp;
+}
+
+// travel distance from team from's venue to team to's
+static inline long __TravelCost(Schedule *s, int from, int to) {
+	return __Distance(&s->cost, ((from - 1) * TEAMS(s)) + (to - 1));
+}
+
+// cost of the leg the viewed team travels to get to round r
+// round num_rounds is the trip home
+static inline long __ViewLegCost(Schedule *s, const TeamView *v, int r) {
+	return __TravelCost(s, __ViewLocation(s, v, r - 1), __ViewLocation(s, v, r));
+}
+
+// cost of the legs touching rounds r_k and r_l for the viewed team
+static inline long __ViewRoundsCost(Schedule *s, const TeamView *v, int r_k, int r_l) {
+	int lo = (r_k < r_l) ? r_k : r_l;
+	int hi = (r_k < r_l) ? r_l : r_k;
+	long cost = __ViewLegCost(s, v, lo) + __ViewLegCost(s, v, lo + 1);
+	if (hi != lo) {
+		// adjacent rounds share the leg between them
+		if (hi != lo + 1) {
+			cost += __ViewLegCost(s, v, hi);
+		}
+		cost += __ViewLegCost(s, v, hi + 1);
+	}
+	return cost;
+}
+
+// number of atmost violations for the viewed team ending at round r
+// atmost is violated when r is the last of ATMOST + 1 games at the same venue
+static inline int __ViewAtmostViolation(Schedule *s, const TeamView *v, int r) {
+	if (r < ATMOST || r >= ROUNDS(s)) {
+		return 0;
+	}
+	bool home = __ViewSlot(s, v, r) > 0;
+	for (int i = r - ATMOST; i < r; i++) {
+		if ((__ViewSlot(s, v, i) > 0) != home) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// number of norepeat violations for the viewed team ending at round r
+// norepeat is violated when r has the same opponent as the round before
+static inline int __ViewRepeatViolation(Schedule *s, const TeamView *v, int r) {
+	if (r < 1 || r >= ROUNDS(s)) {
+		return 0;
+	}
+	return abs(__ViewSlot(s, v, r - 1)) == abs(__ViewSlot(s, v, r));
+}
+
+// number of violations for the viewed team ending anywhere in rounds lo to hi
+static inline int __ViewRangeViolations(Schedule *s, const TeamView *v, int lo, int hi) {
+	int nbv = 0;
+	if (hi >= ROUNDS(s)) {
+		hi = ROUNDS(s) - 1;
+	}
+	for (int r = lo; r <= hi; r++) {
+		nbv += __ViewAtmostViolation(s, v, r) + __ViewRepeatViolation(s, v, r);
+	}
+	return nbv;
+}
+
+// number of violations for the viewed team that can change when rounds r_k
+// and r_l change
+static inline int __ViewRoundsViolations(Schedule *s, const TeamView *v, int r_k, int r_l) {
+	int lo = (r_k < r_l) ? r_k : r_l;
+	int hi = (r_k < r_l) ? r_l : r_k;
+	if (hi - lo <= ATMOST) {
+		return __ViewRangeViolations(s, v, lo, hi + ATMOST);
+	}
+	return __ViewRangeViolations(s, v, lo, lo + ATMOST) + 
+			__ViewRangeViolations(s, v, hi, hi + ATMOST);
+}
+
+// number of atmost violations for the viewed team that can change when the
+// venues of rounds r_k and r_l change
+static inline int __ViewRoundsAtmost(Schedule *s, const TeamView *v, int r_k, int r_l) {
+	int lo = (r_k < r_l) ? r_k : r_l;
+	int hi = (r_k < r_l) ? r_l : r_k;
+	int nbv = 0;
+	for (int r = lo; r <= lo + ATMOST && r < hi; r++) {
+		nbv += __ViewAtmostViolation(s, v, r);
+	}
+	for (int r = hi; r <= hi + ATMOST; r++) {
+		nbv += __ViewAtmostViolation(s, v, r);
+	}
+	return nbv;
+}
+
+// number of norepeat violations for the viewed team that can change when
+// the opponents of rounds r_k and r_l change
+static inline int __ViewRoundsRepeat(Schedule *s, const TeamView *v, int r_k, int r_l) {
+	int lo = (r_k < r_l) ? r_k : r_l;
+	int hi = (r_k < r_l) ? r_l : r_k;
+	int nbv = __ViewRepeatViolation(s, v, lo) + __ViewRepeatViolation(s, v, lo + 1);
+	if (hi != lo) {
+		if (hi != lo + 1) {
+			nbv += __ViewRepeatViolation(s, v, hi);
+		}
+		nbv += __ViewRepeatViolation(s, v, hi + 1);
+	}
+	return nbv;
+}
+
+// The same for team t's games as they are
+
+static inline int __Location(Schedule *s, int t, int r) {
+	return __ViewLocation(s, &TEAM_VIEW(t), r);
+}
+
+static inline long __LegCost(Schedule *s, int t, int r) {
+	return __ViewLegCost(s, &TEAM_VIEW(t), r);
+}
+
+static inline long __RoundsCost(Schedule *s, int t, int r_k, int r_l) {
+	return __ViewRoundsCost(s, &TEAM_VIEW(t), r_k, r_l);
+}
+
+static inline int __AtmostViolation(Schedule *s, int t, int r) {
+	return __ViewAtmostViolation(s, &TEAM_VIEW(t), r);
+}
+
+static inline int __RepeatViolation(Schedule *s, int t, int r) {
+	return __ViewRepeatViolation(s, &TEAM_VIEW(t), r);
+}
+
+static inline int __RangeViolations(Schedule *s, int t, int lo, int hi) {
+	return __ViewRangeViolations(s, &TEAM_VIEW(t), lo, hi);
+}
+
+static inline int __RoundsViolations(Schedule *s, int t, int r_k, int r_l) {
+	return __ViewRoundsViolations(s, &TEAM_VIEW(t), r_k, r_l);
+}
+
+// apply a change in the number of violations to team t
+static inline void __AddViolations(Schedule *s, int t, int delta) {
+	s->viol.team_nbv[t] += delta;
+	s->viol.nbv += delta;
+}
+
+// apply a change in travel distance to team t
+static inline void __AddCost(Schedule *s, int t, long delta) {
+	s->cost.team_cost[t] += delta;
+	s->cost.total_cost += delta;
+}
+
+// record a change made by the current move
+static inline void __Record(Schedule *s, int r, int t, int val, long cost, int nbv) {
+	Journal *j = &s->journal;
+	if (j->num_changes == j->max_changes) {
+		j->max_changes *= 2;
+		j->change = realloc(j->change, j->max_changes * sizeof(*(j->change)));
+	}
+	Change *c = &j->change[j->num_changes++];
+	c->round = r;
+	c->team = t;
+	c->val = val;
+	c->cost = cost;
+	c->nbv = nbv;
+}
+
+// start recording a new move
+static inline void __BeginMove(Schedule *s) {
+	s->journal.num_changes = 0;
+	s->num_moves++;
+}
+
+// undo every change made by the current move, newest first
+static inline void __Rollback(Schedule *s) {
+	Journal *j = &s->journal;
+	while (j->num_changes) {
+		Change *c = &j->change[--j->num_changes];
+		if (c->team == 0) {
+			int tmp = s->round[c->round];
+			s->round[c->round] = s->round[c->val];
+			s->round[c->val] = tmp;
+			continue;
+		}
+		if (c->round >= 0) {
+			SLOT(s, c->round, c->team) = c->val;
+		}
+		__AddCost(s, c->team, -c->cost);
+		__AddViolations(s, c->team, -c->nbv);
+	}
+}
+
+// set the opponent of team t in round r, updating the cost of team t
+// by only the two legs that touch round r, and the violations of team t
+// by only the rounds that can see round r
+static inline void __SetTeam(Schedule *s, int r, int t, int val) {
+	int old = SLOT(s, r, t);
+	long delta = 0;
+	int nbv = 0;
+	bool venue = (old > 0) != (val > 0);
+	bool opponent = abs(old) != abs(val);
+	// the location only changes if this is or becomes an away game
+	if (old < 0 || val < 0) {
+		delta -= __LegCost(s, t, r) + __LegCost(s, t, r + 1);
+	}
+	if (venue) {
+		for (int i = r; i <= r + ATMOST; i++) {
+			nbv -= __AtmostViolation(s, t, i);
+		}
+	}
+	if (opponent) {
+		nbv -= __RepeatViolation(s, t, r) + __RepeatViolation(s, t, r + 1);
+	}
+	SLOT(s, r, t) = val;
+	if (old < 0 || val < 0) {
+		delta += __LegCost(s, t, r) + __LegCost(s, t, r + 1);
+		__AddCost(s, t, delta);
+	}
+	if (venue) {
+		for (int i = r; i <= r + ATMOST; i++) {
+			nbv += __AtmostViolation(s, t, i);
+		}
+	}
+	if (opponent) {
+		nbv += __RepeatViolation(s, t, r) + __RepeatViolation(s, t, r + 1);
+	}
+	if (nbv) {
+		__AddViolations(s, t, nbv);
+	}
+	__Record(s, r, t, old, delta, nbv);
+}
+
+// Neighborhood functions
+// Each move keeps the costs up to date itself, only looking at the legs
+// touched by the rounds it changes
+// Swaps the home and away games for team i and j
+static inline void SwapHomes(Schedule *s, int t_i, int t_j) {
+	int j = 0;
+	for (int i = 0; i < ROUNDS(s); i++) {
+		if (abs(SLOT(s, i, t_i)) == t_j) {
+			j++;
+			__SetTeam(s, i, t_i, -SLOT(s, i, t_i));
+			__SetTeam(s, i, t_j, -SLOT(s, i, t_j));
+		} 
+		if (j == 2) {
+			break;
+		}
+	}
+}
+
+// Swaps rounds k and l
+static inline void SwapRounds(Schedule *s, int r_k, int r_l) {
+	long *delta = s->cost.delta;
+	int *nbv = s->viol.delta;
+	for (int i = 1; i <= TEAMS(s); i++) {
+		delta[i] = -__RoundsCost(s, i, r_k, r_l);
+		nbv[i] = -__RoundsViolations(s, i, r_k, r_l);
+	}
+	int tmp = s->round[r_k];
+	s->round[r_k] = s->round[r_l];
+	s->round[r_l] = tmp;
+	__Record(s, r_k, 0, r_l, 0, 0);
+	for (int i = 1; i <= TEAMS(s); i++) {
+		delta[i] += __RoundsCost(s, i, r_k, r_l);
+		nbv[i] += __RoundsViolations(s, i, r_k, r_l);
+		__AddCost(s, i, delta[i]);
+		__AddViolations(s, i, nbv[i]);
+		__Record(s, -1, i, 0, delta[i], nbv[i]);
+	}
+}
+
+// Swaps teams i and j
+static inline void SwapTeams(Schedule *s, int t_i, int t_j) {
+	for (int i = 0; i < ROUNDS(s); i++) {
+		// teams are playing each other, skip
+		if (abs(SLOT(s, i, t_i)) == t_j) {
+			continue;
+		} else {
+			// swap the two teams
+			int tmp = SLOT(s, i, t_i);
+			__SetTeam(s, i, t_i, SLOT(s, i, t_j));
+			__SetTeam(s, i, t_j, tmp);
+			// update the other teams
+			__SetTeam(s, i, abs(tmp), (tmp > 0) ? -t_j : t_j);
+			tmp = SLOT(s, i, t_i);
+			__SetTeam(s, i, abs(tmp), (tmp > 0) ? -t_i : t_i);
+		}
+	}
+}
+
+// teams whose games at rounds k and l must swap along with team i's,
+// flagged in a scratch array of TEAMS(s) + 1 to give back when done
+// found by following the games at k and l out from team i
+static inline int *__SwapSet(Schedule *s, int t_i, int r_k, int r_l) {
+	int *swap = __ScratchGet(s, TEAMS(s) + 1);
+	int *stack = __ScratchGet(s, TEAMS(s));
+	int top = 0;
+	swap[t_i] = 1;
+	stack[top++] = t_i;
+	while (top) {
+		int i = stack[--top];
+		int tmp = abs(SLOT(s, r_k, i));
+		if (!swap[tmp]) {
+			swap[tmp] = 1;
+			stack[top++] = tmp;
+		}
+		tmp = abs(SLOT(s, r_l, i));
+		if (!swap[tmp]) {
+			swap[tmp] = 1;
+			stack[top++] = tmp;
+		}
+	}
+	__ScratchPut(s, TEAMS(s));
+	return swap;
+}
+
+// swaps games for a single team at rounds k and l
+static inline void PartialSwapRounds(Schedule *s, int t_i, int r_k, int r_l) {
+	// get list of teams to swap
+	int *swap = __SwapSet(s, t_i, r_k, r_l);
+
+	// swap all affect teams
+	for (int i = 1; i <= TEAMS(s); i++) {
+		if (swap[i]) {
+			int tmp = SLOT(s, r_k, i);
+			__SetTeam(s, r_k, i, SLOT(s, r_l, i));
+			__SetTeam(s, r_l, i, tmp);
+		}
+	}
+	__ScratchPut(s, TEAMS(s) + 1);
+}
+
+// swaps the games of teams i and j, then updates the schedule
+static inline void PartialSwapTeams(Schedule *s, int t_i, int t_j, int r_k) {
+	// if trying an invalid swap, just return
+	if (t_i == abs(SLOT(s, r_k, t_j)) ||
+			t_j == abs(SLOT(s, r_k, t_i))) {
+		return;
+	}
+	// first swap the current round
+	int tmp = SLOT(s, r_k, t_i);
+	__SetTeam(s, r_k, t_i, SLOT(s, r_k, t_j));
+	__SetTeam(s, r_k, t_j, tmp);
+	// now swap the affected teams in the same round
+	__SetTeam(s, r_k, abs(tmp), (tmp > 0) ? - t_j : t_j);
+	tmp = SLOT(s, r_k, t_i);
+	__SetTeam(s, r_k, abs(tmp), (tmp > 0) ? - t_i : t_i);
+	// now run recursively on any affected rounds
+	for (int i = 0; i < ROUNDS(s); i++) {
+		if (i == r_k) {
+			continue;
+		}
+		if (SLOT(s, r_k, t_i) == SLOT(s, i, t_i) ||
+			SLOT(s, r_k, t_j) == SLOT(s, i, t_j)) {
+			PartialSwapTeams(s, t_i, t_j, i);
+		}
+		int t1 = abs(SLOT(s, r_k, t_i));
+		int t2 = abs(SLOT(s, r_k, t_j));
+		if (SLOT(s, r_k, t1) == SLOT(s, i, t1) ||
+			SLOT(s, r_k, t2) == SLOT(s, i, t2)) {
+			PartialSwapTeams(s, t1, t2, i);
+		}
+	}
+}
+
+static inline double __Sublinear(int v) {
+	return 1 + (sqrt(v) * log(v) / 2);
+}
+
+// Objective function of a schedule costing cost with nbv violations
+static inline double __ObjectiveOf(unsigned long cost, int weight, int nbv) {
+	if (nbv) {
+		double tmp = weight * __Sublinear(nbv);
+		return sqrt((double) (cost * cost) + (tmp * tmp));
+	} else {
+		return (double) cost;
+	}
+}
+
+// Objective function
+static inline double __Objective(Schedule *s, int weight, int nbv) {
+	return __ObjectiveOf(s->cost.total_cost, weight, nbv);
+}
+
+// Pick a random move, its teams and rounds are always distinct
+static inline void __RandomMove(Schedule *s, Move *m) {
+	// pick the second team and round from the ones not already picked
+	m->t_i = __RandRange(s, TEAMS(s)) + 1;
+	m->t_j = __RandRange(s, TEAMS(s) - 1) + 1;
+	if (m->t_j >= m->t_i) {
+		m->t_j++;
+	}
+	m->r_k = __RandRange(s, ROUNDS(s));
+	m->r_l = __RandRange(s, ROUNDS(s) - 1);
+	if (m->r_l >= m->r_k) {
+		m->r_l++;
+	}
+	m->type = __RandRange(s, NUM_MOVES);
+}
+
+// make a move, recording it in the journal
+static inline void __MakeMove(Schedule *s, Move *m) {
+	switch(m->type) {
+		case MOVE_SWAP_HOMES:
+			SwapHomes(s, m->t_i, m->t_j);
+			break;
+		case MOVE_SWAP_ROUNDS:
+			SwapRounds(s, m->r_k, m->r_l);
+			break;
+		case MOVE_SWAP_TEAMS:
+			SwapTeams(s, m->t_i, m->t_j);
+			break;
+		case MOVE_PARTIAL_SWAP_ROUNDS:
+			PartialSwapRounds(s, m->t_i, m->r_k, m->r_l);
+			break;
+		case MOVE_PARTIAL_SWAP_TEAMS:
+			PartialSwapTeams(s, m->t_i, m->t_j, m->r_l);
+			break;
+	}
+}
+
+// Apply a move, recording it in the journal so it can be rolled back
+static inline void __ApplyMove(Schedule *s, Move *m) {
+	__BeginMove(s);
+	__MakeMove(s, m);
+}
+
+// Evaluation functions
+// Each works out the change a move would make from the games it reads,
+// without writing to the schedule, leaving the change to each team it
+// touches in cost.delta and viol.delta for __CommitMove
+
+// add the change to team t's cost and violations if its games in rounds
+// r_k and r_l were val_k and val_l
+static inline void __TeamDelta(Schedule *s, int t, int r_k, int val_k, \
+		int r_l, int val_l, MoveDelta *d) {
+	int old_k = SLOT(s, r_k, t);
+	int old_l = SLOT(s, r_l, t);
+	TeamView old = TEAM_VIEW(t);
+	TeamView new = {t, r_k, val_k, r_l, val_l};
+	long cost = 0;
+	int nbv = 0;
+	// as in __SetTeam, only look at what can change
+	if (old_k < 0 || old_l < 0 || val_k < 0 || val_l < 0) {
+		cost = __ViewRoundsCost(s, &new, r_k, r_l) - __ViewRoundsCost(s, &old, r_k, r_l);
+	}
+	if ((old_k > 0) != (val_k > 0) || (old_l > 0) != (val_l > 0)) {
+		nbv += __ViewRoundsAtmost(s, &new, r_k, r_l) - __ViewRoundsAtmost(s, &old, r_k, r_l);
+	}
+	if (abs(old_k) != abs(val_k) || abs(old_l) != abs(val_l)) {
+		nbv += __ViewRoundsRepeat(s, &new, r_k, r_l) - __ViewRoundsRepeat(s, &old, r_k, r_l);
+	}
+	s->cost.delta[t] = cost;
+	s->viol.delta[t] = nbv;
+	d->cost += cost;
+	d->nbv += nbv;
+}
+
+// the two rounds teams i and j play each other, -1 if missing
+static inline void __MeetingRounds(Schedule *s, int t_i, int t_j, int *r_a, int *r_b) {
+	*r_a = *r_b = -1;
+	for (int i = 0; i < ROUNDS(s); i++) {
+		if (abs(SLOT(s, i, t_i)) == t_j) {
+			if (*r_a < 0) {
+				*r_a = i;
+			} else {
+				*r_b = i;
+				break;
+			}
+		}
+	}
+}
+
+static inline void __EvaluateSwapHomes(Schedule *s, int t_i, int t_j, MoveDelta *d) {
+	int r_a, r_b;
+	__MeetingRounds(s, t_i, t_j, &r_a, &r_b);
+	if (r_a < 0) {
+		return;
+	}
+	// a single meeting changes only r_a
+	int r_l = (r_b < 0) ? r_a : r_b;
+	int val_l = (r_b < 0) ? -SLOT(s, r_a, t_i) : -SLOT(s, r_b, t_i);
+	__TeamDelta(s, t_i, r_a, -SLOT(s, r_a, t_i), r_l, val_l, d);
+	val_l = (r_b < 0) ? -SLOT(s, r_a, t_j) : -SLOT(s, r_b, t_j);
+	__TeamDelta(s, t_j, r_a, -SLOT(s, r_a, t_j), r_l, val_l, d);
+}
+
+static inline void __EvaluateSwapRounds(Schedule *s, int r_k, int r_l, MoveDelta *d) {
+	for (int i = 1; i <= TEAMS(s); i++) {
+		__TeamDelta(s, i, r_k, SLOT(s, r_l, i), r_l, SLOT(s, r_k, i), d);
+	}
+}
+
+// cost and violations of team t's tour if it took over team u's games,
+// apart from the rounds they play each other, as SwapTeams leaves it
+static inline void __SwappedTour(Schedule *s, int t, int u, long *cost, int *nbv) {
+	int prev_loc = t, prev_opp = 0, run = 0;
+	*cost = 0;
+	*nbv = 0;
+	for (int r = 0; r < ROUNDS(s); r++) {
+		int opp = (abs(SLOT(s, r, t)) == u) ? SLOT(s, r, t) : SLOT(s, r, u);
+		int loc = (opp > 0) ? t : -opp;
+		*cost += __TravelCost(s, prev_loc, loc);
+		// games in a row at the same venue, and the same opponent twice
+		run = (r && (opp > 0) == (prev_opp > 0)) ? run + 1 : 1;
+		*nbv += (run > ATMOST) + (r && abs(opp) == abs(prev_opp));
+		prev_loc = loc;
+		prev_opp = opp;
+	}
+	*cost += __TravelCost(s, prev_loc, t);
+}
+
+// team a for b and b for a, any other team as it is
+static inline int __Swapped(int x, int a, int b) {
+	return (x == a) ? b : (x == b) ? a : x;
+}
+
+// change to team k's cost around round r, where it visits team i or j,
+// once SwapTeams makes every visit to one a visit to the other
+// the leg after r is left to the next round when that is a visit too
+static inline long __SwappedVisit(Schedule *s, int k, int r, int t_i, int t_j) {
+	int prev_loc = __Location(s, k, r - 1);
+	int loc = __Location(s, k, r);
+	int next_loc = __Location(s, k, r + 1);
+	long delta = __TravelCost(s, __Swapped(prev_loc, t_i, t_j), __Swapped(loc, t_i, t_j)) - \
+			__TravelCost(s, prev_loc, loc);
+	if (next_loc != t_i && next_loc != t_j) {
+		delta += __TravelCost(s, __Swapped(loc, t_i, t_j), next_loc) - \
+				__TravelCost(s, loc, next_loc);
+	}
+	return delta;
+}
+
+static inline void __EvaluateSwapTeams(Schedule *s, int t_i, int t_j, MoveDelta *d) {
+	long *delta = s->cost.delta;
+	int *nbv = s->viol.delta;
+	for (int i = 1; i <= TEAMS(s); i++) {
+		delta[i] = 0;
+		nbv[i] = 0;
+	}
+	long cost;
+	int viol;
+	__SwappedTour(s, t_i, t_j, &cost, &viol);
+	delta[t_i] = cost - s->cost.team_cost[t_i];
+	nbv[t_i] = viol - s->viol.team_nbv[t_i];
+	__SwappedTour(s, t_j, t_i, &cost, &viol);
+	delta[t_j] = cost - s->cost.team_cost[t_j];
+	nbv[t_j] = viol - s->viol.team_nbv[t_j];
+	// the other teams keep their venues and opponents' order, so only their
+	// visits to i and j change, and only in cost
+	for (int i = 0; i < ROUNDS(s); i++) {
+		int a = SLOT(s, i, t_i);
+		int b = SLOT(s, i, t_j);
+		if (abs(a) == t_j) {
+			continue;
+		}
+		if (a > 0) {
+			delta[a] += __SwappedVisit(s, a, i, t_i, t_j);
+		}
+		if (b > 0) {
+			delta[b] += __SwappedVisit(s, b, i, t_i, t_j);
+		}
+	}
+	for (int i = 1; i <= TEAMS(s); i++) {
+		d->cost += delta[i];
+	}
+	d->nbv += nbv[t_i] + nbv[t_j];
+}
+
+static inline void __EvaluatePartialSwapRounds(Schedule *s, int t_i, int r_k, int r_l, \
+		MoveDelta *d) {
+	int *swap = __SwapSet(s, t_i, r_k, r_l);
+	for (int i = 1; i <= TEAMS(s); i++) {
+		if (swap[i]) {
+			__TeamDelta(s, i, r_k, SLOT(s, r_l, i), r_l, SLOT(s, r_k, i), d);
+		}
+	}
+	__ScratchPut(s, TEAMS(s) + 1);
+}
+
+// Work out the change move m would make into d, without making it
+// returns false for PartialSwapTeams, whose chain of repairs depends on the
+// swaps made before each one, so it has to be made to be evaluated
+static inline bool __EvaluateMove(Schedule *s, Move *m, MoveDelta *d) {
+	d->cost = 0;
+	d->nbv = 0;
+	d->objective = 0;
+	switch(m->type) {
+		case MOVE_SWAP_HOMES:
+			__EvaluateSwapHomes(s, m->t_i, m->t_j, d);
+			return true;
+		case MOVE_SWAP_ROUNDS:
+			__EvaluateSwapRounds(s, m->r_k, m->r_l, d);
+			return true;
+		case MOVE_SWAP_TEAMS:
+			__EvaluateSwapTeams(s, m->t_i, m->t_j, d);
+			return true;
+		case MOVE_PARTIAL_SWAP_ROUNDS:
+			__EvaluatePartialSwapRounds(s, m->t_i, m->r_k, m->r_l, d);
+			return true;
+	}
+	return false;
+}
+
+// make a move __EvaluateMove has just evaluated, writing only the games it
+// changes and adding the deltas it left for each team, without recording it
+static inline void __CommitMove(Schedule *s, Move *m) {
+	int r_a, r_b, *swap;
+	switch(m->type) {
+		case MOVE_SWAP_HOMES:
+			__MeetingRounds(s, m->t_i, m->t_j, &r_a, &r_b);
+			for (int i = 0; i < 2; i++) {
+				int r = (i) ? r_b : r_a;
+				if (r >= 0) {
+					SLOT(s, r, m->t_i) = -SLOT(s, r, m->t_i);
+					SLOT(s, r, m->t_j) = -SLOT(s, r, m->t_j);
+				}
+			}
+			__AddCost(s, m->t_i, s->cost.delta[m->t_i]);
+			__AddViolations(s, m->t_i, s->viol.delta[m->t_i]);
+			__AddCost(s, m->t_j, s->cost.delta[m->t_j]);
+			__AddViolations(s, m->t_j, s->viol.delta[m->t_j]);
+			return;
+		case MOVE_SWAP_ROUNDS:
+			r_a = s->round[m->r_k];
+			s->round[m->r_k] = s->round[m->r_l];
+			s->round[m->r_l] = r_a;
+			break;
+		case MOVE_SWAP_TEAMS:
+			for (int i = 0; i < ROUNDS(s); i++) {
+				int a = SLOT(s, i, m->t_i);
+				int b = SLOT(s, i, m->t_j);
+				if (abs(a) == m->t_j) {
+					continue;
+				}
+				SLOT(s, i, m->t_i) = b;
+				SLOT(s, i, m->t_j) = a;
+				SLOT(s, i, abs(a)) = (a > 0) ? -m->t_j : m->t_j;
+				SLOT(s, i, abs(b)) = (b > 0) ? -m->t_i : m->t_i;
+			}
+			break;
+		case MOVE_PARTIAL_SWAP_ROUNDS:
+			swap = __SwapSet(s, m->t_i, m->r_k, m->r_l);
+			for (int i = 1; i <= TEAMS(s); i++) {
+				if (swap[i]) {
+					int tmp = SLOT(s, m->r_k, i);
+					SLOT(s, m->r_k, i) = SLOT(s, m->r_l, i);
+					SLOT(s, m->r_l, i) = tmp;
+					__AddCost(s, i, s->cost.delta[i]);
+					__AddViolations(s, i, s->viol.delta[i]);
+				}
+			}
+			__ScratchPut(s, TEAMS(s) + 1);
+			return;
+	}
+	// every team can change
+	for (int i = 1; i <= TEAMS(s); i++) {
+		__AddCost(s, i, s->cost.delta[i]);
+		__AddViolations(s, i, s->viol.delta[i]);
+	}
+}
+
+static inline double __Seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// Adaptive move selection
+// Each move's chance follows the objective it has gained per nanosecond
+// spent on it, as running averages, over a floor so every move is still
+// tried and its averages kept current
+
+// chances are out of POLICY_SCALE
+#define POLICY_SCALE		65536
+// least chance of any move
+#define POLICY_FLOOR		0.02
+// weight of the newest attempt in the running averages of gain and time
+#define POLICY_GAIN_RATE	(1.0 / 1024)
+#define POLICY_NS_RATE		(1.0 / 16)
+// moves between updates of the chances, less one
+#define POLICY_UPDATE_MASK	1023
+// moves between timed ones, less one, so the clock stays out of most moves
+#define POLICY_SAMPLE_MASK	15
+
+typedef struct {
+	// chance out of POLICY_SCALE of picking each move or one before it
+	uint32_t cumulative[NUM_MOVES];
+	// objective gained per attempt, and ns per timed attempt
+	double gain[NUM_MOVES];
+	double ns[NUM_MOVES];
+	unsigned long moves;
+} MovePolicy;
+
+// start with every move as likely
+static inline void __InitPolicy(MovePolicy *p) {
+	memset(p, 0, sizeof(*p));
+	for (int f = 0; f < NUM_MOVES; f++) {
+		p->cumulative[f] = ((f + 1) * POLICY_SCALE) / NUM_MOVES;
+	}
+}
+
+static inline int __PolicyPick(Schedule *s, MovePolicy *p) {
+	uint32_t x = __RandRange(s, POLICY_SCALE);
+	int f = 0;
+	while (f < NUM_MOVES - 1 && x >= p->cumulative[f]) {
+		f++;
+	}
+	return f;
+}
+
+// set the chances from the averages, once every move has been timed and
+// one has gained something
+static inline void __PolicyChances(MovePolicy *p) {
+	double rate[NUM_MOVES], total = 0;
+	for (int f = 0; f < NUM_MOVES; f++) {
+		if (p->ns[f] == 0) {
+			return;
+		}
+		rate[f] = p->gain[f] / p->ns[f];
+		total += rate[f];
+	}
+	if (total <= 0) {
+		return;
+	}
+	double sum = 0;
+	for (int f = 0; f < NUM_MOVES; f++) {
+		sum += POLICY_FLOOR + ((1 - (NUM_MOVES * POLICY_FLOOR)) * rate[f] / total);
+		p->cumulative[f] = (uint32_t) (sum * POLICY_SCALE);
+	}
+	p->cumulative[NUM_MOVES - 1] = POLICY_SCALE;
+}
+
+// time of the start of the next move if it is to be timed, else 0
+static inline double __PolicyStart(MovePolicy *p) {
+	return (p && !(p->moves & POLICY_SAMPLE_MASK)) ? __Seconds() : 0;
+}
+
+// record an attempt of move f that gained gain, started at start if timed
+static inline void __PolicyRecord(MovePolicy *p, int f, double gain, double start) {
+	if (p == NULL) {
+		return;
+	}
+	p->gain[f] += (((gain > 0) ? gain : 0) - p->gain[f]) * POLICY_GAIN_RATE;
+	if (start) {
+		double ns = (__Seconds() - start) * 1e9;
+		p->ns[f] = (p->ns[f]) ? p->ns[f] + ((ns - p->ns[f]) * POLICY_NS_RATE) : ns;
+	}
+	if (!(++p->moves & POLICY_UPDATE_MASK)) {
+		__PolicyChances(p);
+	}
+}
+
+// Propose a random move m, picked by policy if it is not NULL, setting d to
+// the change still to be made by __AcceptMove. That is the whole move when
+// it could be evaluated, else nothing, as it was made here, and true is
+// returned so __RejectMove knows to undo it
+static inline bool __ProposeMove(Schedule *s, MovePolicy *policy, Move *m, MoveDelta *d) {
+	__RandomMove(s, m);
+	if (policy) {
+		m->type = __PolicyPick(s, policy);
+	}
+	STAT_START(start);
+	__BeginMove(s);
+	bool made = !__EvaluateMove(s, m, d);
+	if (made) {
+		__MakeMove(s, m);
+	}
+	STAT_INC(s, move[m->type].attempts);
+	STAT_CYCLES(s, move[m->type].move_cycles, start);
+	return made;
+}
+
+// objective of s once the proposed move is accepted
+static inline double __ProposedObjective(Schedule *s, int weight, MoveDelta *d) {
+	return __ObjectiveOf(s->cost.total_cost + d->cost, weight, s->viol.nbv + d->nbv);
+}
+
+static inline void __AcceptMove(Schedule *s, Move *m, bool made) {
+	if (!made) {
+		STAT_START(start);
+		__CommitMove(s, m);
+		STAT_CYCLES(s, move[m->type].move_cycles, start);
+	}
+}
+
+static inline void __RejectMove(Schedule *s, Move *m, bool made) {
+	if (made) {
+		STAT_START(start);
+		__Rollback(s);
+		STAT_CYCLES(s, move[m->type].rollback_cycles, start);
+	}
+}
+
+#ifdef CHECK
+// abort unless s is before again, its games, costs and violations, after a
+// move on it was rejected
+static void __CheckRollback(Schedule *s, Schedule *before, Move *m) {
+	bool same = s->cost.total_cost == before->cost.total_cost && \
+			s->viol.nbv == before->viol.nbv;
+	for (int t = 1; t <= TEAMS(s); t++) {
+		same = same && s->cost.team_cost[t] == before->cost.team_cost[t] && \
+				s->viol.team_nbv[t] == before->viol.team_nbv[t];
+		for (int r = 0; r < ROUNDS(s); r++) {
+			same = same && SLOT(s, r, t) == SLOT(before, r, t);
+		}
+	}
+	if (!same) {
+		printf("Error: %s rejected after %lu moves was not rolled back\n", \
+				MOVE_NAMES[m->type], s->num_moves);
+		fflush(stdout);
+		abort();
+	}
+}
+
+// a copy of the schedule taken before each move, to check rejected ones
+// against, only kept when built with CHECK
+#define CHECK_START(v, s)		Schedule *v = CloneSchedule(s)
+#define CHECK_SAVE(v, s)		CopySchedule((v), (s), false)
+#define CHECK_REJECTED(v, s, m)	__CheckRollback((s), (v), (m))
+#define CHECK_END(v)			DeleteSchedule(v)
+#else
+#define CHECK_START(v, s)
+#define CHECK_SAVE(v, s)
+#define CHECK_REJECTED(v, s, m)
+#define CHECK_END(v)
+#endif
+
+#define UL_INF ((unsigned long) ~0)
+
+// Where an annealing run is, everything besides the schedules needed to
+// carry on from a checkpoint
+// settings holds the current temperature and weight
+typedef struct {
+	Settings settings;
+	double best_feasible, nbf;
+	double best_infeasible, nbi;
+	double old_cost;
+	double num_cycles;
+	int best_temp;
+	int reheat;
+	int phase;
+	int counter;
+	MovePolicy policy;
+} AnnealState;
+
+// write a checkpoint of an annealing run to filename, in ttp.c
+bool WriteCheckpoint(Schedule *sbi, Schedule *sbf, AnnealState *st, char *filename);
+
+// moves between checks of the time limit, less one
+#define TIME_CHECK_MASK		255
+
+// tell settings->progress of a new best feasible cost found elapsed seconds
+// into a run, returns false if it asks to stop
+static inline bool __Progress(Settings *settings, unsigned long cost, double elapsed) {
+	return !settings->progress || settings->progress(settings->progress_data, cost, elapsed);
+}
+
+// true once past deadline, only reading the clock every TIME_CHECK_MASK + 1
+// moves so the annealing loop doesn't pay for it on every move
+static inline bool __OutOfTime(Schedule *s, double deadline) {
+	return deadline && !(s->num_moves & TIME_CHECK_MASK) && __Seconds() >= deadline;
+}
+
+// record a sample of an annealing run started at start to settings->trace
+static inline void __TraceAnneal(Settings *settings, Schedule *sbi, AnnealState *st, \
+		double start) {
+	TraceSample sample = {__Seconds() - start, sbi->num_moves, settings->temp, \
+			settings->weight, st->old_cost, sbi->viol.nbv, 0, st->best_feasible, \
+			st->best_infeasible};
+	TraceRecord(settings->trace, &sample);
+}
+
+// feasible cost low enough to stop at, within settings->gap percent of s's
+// lower bound, 0 if the bound isn't known
+static inline double __GapTarget(Schedule *s, Settings *settings) {
+	return s->cost.lower_bound * (1 + (settings->gap / 100));
+}
+
+// anneal sbi from state st, keeping the best feasible schedule in sbf
+static inline void __AnnealCore(Schedule *sbi, Schedule *sbf, AnnealState *st) {
+	Settings *settings = &st->settings;
+	int nbv;
+	double total_cycles = (settings->max_reheat + 1) * (settings->max_phase + 1) \
+			* (settings->max_counter + 1);
+	double start = __Seconds();
+	double deadline = (settings->time_limit > 0) ? start + settings->time_limit : 0;
+	bool timed_out = false;
+	double target = __GapTarget(sbi, settings);
+	// within the gap, or told to stop by settings->progress
+	bool stopped = sbf->cost.total_cost <= target;
+	MovePolicy *policy = (settings->policy == POLICY_ADAPTIVE) ? &st->policy : NULL;
+	unsigned long next_sample = sbi->num_moves;
+	CHECK_START(before, sbi);
+	// checked once a phase, so the clock stays out of the inner loop
+	double next_checkpoint = start + settings->checkpoint_every;
+	if (settings->update) {
+		printf("Percentage complete:\n%.2f", (st->num_cycles / total_cycles) * 100.00);
+	}
+	while (st->reheat <= settings->max_reheat) {
+		while (st->phase <= settings->max_phase) {
+			while (st->counter <= settings->max_counter) {
+				bool accept;
+				if (stopped) {
+					break;
+				}
+				if (__OutOfTime(sbi, deadline)) {
+					timed_out = true;
+					break;
+				}
+				Move m;
+				MoveDelta d;
+				CHECK_SAVE(before, sbi);
+				double move_start = __PolicyStart(policy);
+				bool made = __ProposeMove(sbi, policy, &m, &d);
+				nbv = sbi->viol.nbv + d.nbv;
+				double new_cost = __ProposedObjective(sbi, settings->weight, &d);
+				double gain = st->old_cost - new_cost;
+
+				if ((new_cost < st->old_cost) || 
+						(nbv == 0 && new_cost < st->best_feasible) || 
+						(nbv > 0 && new_cost < st->best_infeasible)) {
+					accept = true;
+				} else if (__Chance(sbi, exp((st->old_cost - new_cost) / settings->temp))) {
+					accept = true;
+				} else {
+					accept = false;
+				}
+				if (accept) {
+					__AcceptMove(sbi, &m, made);
+					STAT_INC(sbi, move[m.type].accepts);
+					if (new_cost < st->old_cost) {
+						STAT_INC(sbi, move[m.type].improvements);
+					}
+					if (nbv == 0) {
+						st->nbf = (new_cost < st->best_feasible) ? 
+								new_cost : st->best_feasible;
+						if (st->nbf < st->best_feasible) {
+							sbf->cost.total_cost = (unsigned long) new_cost;
+							CopySchedule(sbf, sbi, false);
+							stopped = !__Progress(settings, sbf->cost.total_cost, \
+									__Seconds() - start) || sbf->cost.total_cost <= target;
+						}
+					} else {
+						st->nbi = (new_cost < st->best_infeasible) ? 
+								new_cost : st->best_infeasible;
+					}
+					if (st->nbf < st->best_feasible || st->nbi < st->best_infeasible) {
+						STAT_INC(sbi, move[m.type].bests);
+						st->reheat = 0; st->counter = 0; st->phase = 0;
+						st->num_cycles = 0;
+						st->best_temp = settings->temp;
+						st->best_feasible = st->nbf;
+						st->best_infeasible = st->nbi;
+						if (nbv == 0) {
+							settings->weight = settings->weight / settings->theta;
+						} else {
+							settings->weight = settings->weight * settings->delta;
+						}
+						new_cost = __Objective(sbi, settings->weight, nbv);
+					} else {
+						st->counter++;
+						st->num_cycles++;
+					}
+					st->old_cost = new_cost;
+				} else {
+					__RejectMove(sbi, &m, made);
+					CHECK_REJECTED(before, sbi, &m);
+				}
+				__PolicyRecord(policy, m.type, (accept) ? gain : 0, move_start);
+				if (settings->trace && sbi->num_moves >= next_sample) {
+					__TraceAnneal(settings, sbi, st, start);
+					next_sample = sbi->num_moves + settings->trace_every;
+				}
+			} // counter
+			if (timed_out || stopped) {
+				break;
+			}
+			st->counter = 0;
+			st->phase++;
+			if (settings->update) {
+				printf("\r%.2f%%\t\t\t", (st->num_cycles / total_cycles) * 100.00);
+			}
+			settings->temp = settings->temp * settings->beta;
+			if (settings->checkpoint && __Seconds() >= next_checkpoint) {
+				if (!WriteCheckpoint(sbi, sbf, st, settings->checkpoint)) {
+					printf("Unable to write file %s\n", settings->checkpoint);
+				}
+				next_checkpoint = __Seconds() + settings->checkpoint_every;
+			}
+		} // phase
+		if (timed_out || stopped) {
+			break;
+		}
+		st->phase = 0;
+		st->reheat++;
+		settings->temp = 2 * st->best_temp;
+	} // reheat
+	CHECK_END(before);
+	if (settings->update) {
+		printf("\n");
+	}
+	// stopped part way, so the run can be carried on later
+	if (timed_out && settings->checkpoint && \
+			!WriteCheckpoint(sbi, sbf, st, settings->checkpoint)) {
+		printf("Unable to write file %s\n", settings->checkpoint);
+	}
+	if (!CheckHardReq(sbf)) {
+		CopySchedule(sbi, sbf, false);
+	}
+}
+
+#define ANNEAL_FIXED_DECL(n) \
+	void AnnealFixed##n(Schedule *sbi, Schedule *sbf, AnnealState *st);
+FIXED_TEAM_COUNTS(ANNEAL_FIXED_DECL)
+#undef ANNEAL_FIXED_DECL
+
+#endif /* CORE_H */
@@ -0,0 +1,77 @@
+// The annealing core compiled for a single team count, built once for each
+// of FIXED_TEAMS in the Makefile with -DFIXED_TEAMS=n
+#include "core.h"
+
+#ifndef FIXED_TEAMS
+#error "fixed.c is built with -DFIXED_TEAMS=n for each fixed team count"
+#endif
+
+#define __ANNEAL_FIXED(n)	AnnealFixed##n
+#define ANNEAL_FIXED(n)		__ANNEAL_FIXED(n)
+
+#ifdef TEAM_MAJOR
+#define FIXED_NUM_ROWS	(FIXED_TEAMS + 1)
+#else
+#define FIXED_NUM_ROWS	ROUNDS(0)
+#endif
+
+// The arrays annealing writes, sized as __CreateSchedule sizes them, so a
+// core keeps the schedule it anneals in one block on its own stack
+typedef struct {
+	Cell slot[(FIXED_NUM_ROWS * FIXED_STRIDE) + CACHE_LINE_CELLS] \
+			__attribute__((aligned(CACHE_LINE)));
+	int round[ROUNDS(0)];
+	unsigned long team_cost[FIXED_TEAMS + 1];
+	uint64_t dirty[(FIXED_TEAMS / 64) + 1];
+	long cost_delta[FIXED_TEAMS + 1];
+	int team_nbv[FIXED_TEAMS + 1];
+	int viol_delta[FIXED_TEAMS + 1];
+	Change change[4 * FIXED_TEAMS * ROUNDS(0)];
+	int scratch[3 * (FIXED_TEAMS + 1)];
+} Storage;
+
+// point the arrays of s at those of f
+static void __UseStorage(Schedule *s, Storage *f) {
+	s->slot = f->slot;
+	s->round = f->round;
+	s->cost.team_cost = f->team_cost;
+	s->cost.dirty = f->dirty;
+	s->cost.delta = f->cost_delta;
+	s->viol.team_nbv = f->team_nbv;
+	s->viol.delta = f->viol_delta;
+	s->journal.change = f->change;
+	s->scratch.mem = f->scratch;
+}
+
+// copy what the arrays of src hold between moves to dst
+// the deltas and scratch space only hold anything during a move, and the
+// journal only the changes of the last one
+#define COPY_STORAGE(dst, src, n) \
+	memcpy((dst)->slot, (src)->slot, sizeof(n.slot)); \
+	memcpy((dst)->round, (src)->round, sizeof(n.round)); \
+	memcpy((dst)->cost.team_cost, (src)->cost.team_cost, sizeof(n.team_cost)); \
+	memcpy((dst)->cost.dirty, (src)->cost.dirty, sizeof(n.dirty)); \
+	memcpy((dst)->viol.team_nbv, (src)->viol.team_nbv, sizeof(n.team_nbv)); \
+	memcpy((dst)->journal.change, (src)->journal.change, \
+			(src)->journal.num_changes * sizeof(*n.change))
+
+void ANNEAL_FIXED(FIXED_TEAMS)(Schedule *sbi, Schedule *sbf, AnnealState *st) {
+	Storage f;
+	Schedule s = *sbi;
+	__UseStorage(&s, &f);
+	COPY_STORAGE(&s, sbi, f);
+	__AnnealCore(&s, sbf, st);
+	COPY_STORAGE(sbi, &s, f);
+	// and the totals, counters and generator, keeping sbi's own arrays
+	Schedule heap = *sbi;
+	*sbi = s;
+	sbi->slot = heap.slot;
+	sbi->round = heap.round;
+	sbi->cost.team_cost = heap.cost.team_cost;
+	sbi->cost.dirty = heap.cost.dirty;
+	sbi->cost.delta = heap.cost.delta;
+	sbi->viol.team_nbv = heap.viol.team_nbv;
+	sbi->viol.delta = heap.viol.delta;
+	sbi->journal.change = heap.journal.change;
+	sbi->scratch.mem = heap.scratch.mem;
+}
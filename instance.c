@@ -0,0 +1,355 @@
+#include "instance.h"
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CACHE_MAGIC		0x44505454	/* "TTPD" */
+#define CACHE_VERSION	2
+#define CACHE_ORDER		0x01020304
+#define NAMES_TAG		"names:"
+// side of the square EUCLID teams are placed in
+#define EUCLID_SIDE		3000
+
+// Header of a binary cache, followed by the distances as int32s and then
+// the team names, each ending in a NUL
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	// written as 0x01020304, anything else is from a machine of other endianness
+	uint32_t order;
+	uint32_t num_teams;
+	uint32_t names_len;
+	// size and modification time of the text file the cache was made from,
+	// all 0 if it wasn't made from one
+	uint32_t source_nsec;
+	uint64_t source_size;
+	int64_t source_sec;
+} CacheHeader;
+
+// map a whole file into memory, returns NULL on failure
+static void *MapFile(char *filename, size_t *len) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+	*len = st.st_size;
+	return map;
+}
+
+static inline bool __IsSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+// parse the distance at *p, moving *p past it
+// returns false unless it is a whole number from 0 to INT_MAX
+static bool __ParseDistance(const char **p, const char *end, int *dist) {
+	bool neg = false;
+	if (**p == '-' || **p == '+') {
+		neg = **p == '-';
+		(*p)++;
+	}
+	if (*p == end || **p < '0' || **p > '9') {
+		return false;
+	}
+	int val = 0;
+	while (*p < end && **p >= '0' && **p <= '9') {
+		int digit = *(*p)++ - '0';
+		if (val > (INT_MAX - digit) / 10) {
+			return false;
+		}
+		val = (val * 10) + digit;
+	}
+	*dist = val;
+	return !neg || val == 0;
+}
+
+// split names out of a "# names:" comment running from p to end
+static char **ParseNames(const char *p, const char *end, int *num_names) {
+	int max_names = 16, n = 0;
+	char **names = calloc(max_names + 1, sizeof(*names));
+	while (p < end) {
+		while (p < end && __IsSpace(*p)) {
+			p++;
+		}
+		const char *start = p;
+		while (p < end && !__IsSpace(*p)) {
+			p++;
+		}
+		if (p == start) {
+			break;
+		}
+		if (n == max_names) {
+			max_names *= 2;
+			names = realloc(names, (max_names + 1) * sizeof(*names));
+		}
+		names[n] = calloc(p - start + 1, sizeof(*(names[n])));
+		memcpy(names[n++], start, p - start);
+	}
+	names[n] = NULL;
+	*num_names = n;
+	return names;
+}
+
+static void FreeNames(char **names) {
+	if (names) {
+		for (int i = 0; names[i]; i++) {
+			free(names[i]);
+		}
+		free(names);
+	}
+}
+
+// parse a text instance
+static Instance *ParseText(const char *p, size_t len) {
+	const char *end = p + len;
+	int max_dist = 256, num_dist = 0, num_names = 0;
+	int *distance = malloc(max_dist * sizeof(*distance));
+	char **names = NULL;
+	while (p < end) {
+		char c = *p;
+		if (__IsSpace(c)) {
+			p++;
+		} else if (c == '#') {
+			const char *eol = memchr(p, '\n', end - p);
+			eol = (eol) ? eol : end;
+			// look for the names tag
+			const char *q = p + 1;
+			while (q < eol && (*q == ' ' || *q == '\t')) {
+				q++;
+			}
+			if (!names && eol - q >= strlen(NAMES_TAG) && \
+					!memcmp(q, NAMES_TAG, strlen(NAMES_TAG))) {
+				names = ParseNames(q + strlen(NAMES_TAG), eol, &num_names);
+			}
+			p = eol;
+		} else {
+			int val;
+			if (!__ParseDistance(&p, end, &val)) {
+				free(distance);
+				FreeNames(names);
+				return NULL;
+			}
+			if (num_dist == max_dist) {
+				max_dist *= 2;
+				distance = realloc(distance, max_dist * sizeof(*distance));
+			}
+			distance[num_dist++] = val;
+		}
+	}
+	int num_teams = (int) sqrt(num_dist);
+	while (num_teams * num_teams < num_dist) {
+		num_teams++;
+	}
+	if (num_teams == 0 || num_teams * num_teams != num_dist || \
+			(names && num_names != num_teams)) {
+		free(distance);
+		FreeNames(names);
+		return NULL;
+	}
+	Instance *inst = calloc(1, sizeof(*inst));
+	inst->num_teams = num_teams;
+	inst->distance = distance;
+	inst->names = names;
+	return inst;
+}
+
+// whether a cache header was made from the file source describes
+static bool __SameSource(CacheHeader *h, const struct stat *source) {
+	return h->source_size == (uint64_t) source->st_size && \
+			h->source_sec == (int64_t) source->st_mtim.tv_sec && \
+			h->source_nsec == (uint32_t) source->st_mtim.tv_nsec;
+}
+
+// use a mapped binary cache, returns NULL if it is not one, or if source is
+// not NULL and it was made from some other version of the file
+static Instance *MapCache(void *map, size_t len, const struct stat *source) {
+	CacheHeader *h = map;
+	if (len < sizeof(*h) || h->magic != CACHE_MAGIC || h->version != CACHE_VERSION || \
+			h->order != CACHE_ORDER || sizeof(int) != sizeof(int32_t)) {
+		return NULL;
+	}
+	if (source && !__SameSource(h, source)) {
+		return NULL;
+	}
+	size_t dist_len = (size_t) h->num_teams * h->num_teams * sizeof(int32_t);
+	if (h->num_teams == 0 || len != sizeof(*h) + dist_len + h->names_len) {
+		return NULL;
+	}
+	Instance *inst = calloc(1, sizeof(*inst));
+	inst->num_teams = h->num_teams;
+	inst->distance = (int *) (h + 1);
+	if (h->names_len) {
+		const char *p = (const char *) inst->distance + dist_len;
+		const char *end = p + h->names_len;
+		inst->names = calloc(inst->num_teams + 1, sizeof(*(inst->names)));
+		for (int i = 0; i < inst->num_teams; i++) {
+			const char *nul = memchr(p, '\0', end - p);
+			if (nul == NULL) {
+				FreeNames(inst->names);
+				free(inst);
+				return NULL;
+			}
+			inst->names[i] = strdup(p);
+			p = nul + 1;
+		}
+	}
+	inst->map = map;
+	inst->map_len = len;
+	return inst;
+}
+
+// load a text file or binary cache
+// if source is not NULL only a binary cache made from that file is loaded
+static Instance *__LoadInstance(char *filename, const struct stat *source) {
+	size_t len;
+	void *map = MapFile(filename, &len);
+	if (map == NULL) {
+		return NULL;
+	}
+	Instance *inst = MapCache(map, len, source);
+	if (inst == NULL) {
+		inst = (source) ? NULL : ParseText(map, len);
+		munmap(map, len);
+	}
+	return inst;
+}
+
+// write inst as a binary cache made from the file source describes, if any
+static bool __WriteInstanceCache(Instance *inst, char *filename, const struct stat *source) {
+	CacheHeader h;
+	memset(&h, 0, sizeof(h));
+	h.magic = CACHE_MAGIC;
+	h.version = CACHE_VERSION;
+	h.order = CACHE_ORDER;
+	h.num_teams = inst->num_teams;
+	if (source) {
+		h.source_size = source->st_size;
+		h.source_sec = source->st_mtim.tv_sec;
+		h.source_nsec = source->st_mtim.tv_nsec;
+	}
+	for (int i = 0; inst->names && inst->names[i]; i++) {
+		h.names_len += strlen(inst->names[i]) + 1;
+	}
+	// write to a temporary file and move it into place, so a reader never
+	// sees half a cache
+	char *tmpname = calloc(strlen(filename) + strlen(".tmp") + 1, sizeof(*tmpname));
+	sprintf(tmpname, "%s.tmp", filename);
+	FILE *fptr = fopen(tmpname, "wb");
+	if (fptr == NULL) {
+		free(tmpname);
+		return false;
+	}
+	bool ok = fwrite(&h, sizeof(h), 1, fptr) == 1;
+	for (int i = 0; ok && i < inst->num_teams * inst->num_teams; i++) {
+		int32_t dist = inst->distance[i];
+		ok = fwrite(&dist, sizeof(dist), 1, fptr) == 1;
+	}
+	for (int i = 0; ok && inst->names && inst->names[i]; i++) {
+		ok = fwrite(inst->names[i], strlen(inst->names[i]) + 1, 1, fptr) == 1;
+	}
+	ok &= !fclose(fptr);
+	ok = ok && !rename(tmpname, filename);
+	if (!ok) {
+		unlink(tmpname);
+	}
+	free(tmpname);
+	return ok;
+}
+
+Instance *LoadInstance(char *filename, bool cache) {
+	struct stat text;
+	if (!cache || stat(filename, &text)) {
+		return __LoadInstance(filename, NULL);
+	}
+	char *cachename = calloc(strlen(filename) + strlen(".cache") + 1, sizeof(*cachename));
+	sprintf(cachename, "%s.cache", filename);
+	// the cache is only used if it was made from the file as it is now,
+	// the size and modification time to the nanosecond must both match
+	Instance *inst = __LoadInstance(cachename, &text);
+	if (inst == NULL && (inst = __LoadInstance(filename, NULL))) {
+		__WriteInstanceCache(inst, cachename, &text);
+	}
+	free(cachename);
+	return inst;
+}
+
+bool WriteInstanceCache(Instance *inst, char *filename) {
+	return __WriteInstanceCache(inst, filename, NULL);
+}
+
+Instance *MakeInstance(int kind, int num_teams, unsigned seed) {
+	Instance *inst = calloc(1, sizeof(*inst));
+	inst->num_teams = num_teams;
+	inst->distance = calloc(num_teams * num_teams, sizeof(*(inst->distance)));
+	double *x = NULL, *y = NULL;
+	if (kind == INST_EUCLID) {
+		Rng rng;
+		SeedRng(&rng, seed);
+		x = malloc(num_teams * sizeof(*x));
+		y = malloc(num_teams * sizeof(*y));
+		for (int i = 0; i < num_teams; i++) {
+			x[i] = __NextRand(&rng) * (EUCLID_SIDE / 4294967296.0);
+			y[i] = __NextRand(&rng) * (EUCLID_SIDE / 4294967296.0);
+		}
+	}
+	for (int i = 0; i < num_teams; i++) {
+		for (int j = 0; j < num_teams; j++) {
+			int dist = 0;
+			if (i == j) {
+				dist = 0;
+			} else if (kind == INST_CIRC) {
+				dist = abs(i - j);
+				dist = (dist < num_teams - dist) ? dist : num_teams - dist;
+			} else if (kind == INST_CON) {
+				dist = 1;
+			} else {
+				dist = (int) lround(hypot(x[i] - x[j], y[i] - y[j]));
+			}
+			inst->distance[(i * num_teams) + j] = dist;
+		}
+	}
+	free(x);
+	free(y);
+	return inst;
+}
+
+bool WriteInstance(Instance *inst, FILE *f) {
+	if (inst->names) {
+		fprintf(f, "# %s", NAMES_TAG);
+		for (int i = 0; inst->names[i]; i++) {
+			fprintf(f, " %s", inst->names[i]);
+		}
+		fprintf(f, "\n");
+	}
+	for (int i = 0; i < inst->num_teams; i++) {
+		for (int j = 0; j < inst->num_teams; j++) {
+			fprintf(f, (j) ? " %d" : "%d", inst->distance[(i * inst->num_teams) + j]);
+		}
+		fprintf(f, "\n");
+	}
+	return !ferror(f);
+}
+
+void DeleteInstance(Instance *inst) {
+	FreeNames(inst->names);
+	if (inst->map) {
+		munmap(inst->map, inst->map_len);
+	} else {
+		free(inst->distance);
+	}
+	free(inst);
+}
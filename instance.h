@@ -0,0 +1,46 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "ttp.h"
+
+// A problem instance, the distances between every pair of teams
+// Text instances are num_teams * num_teams whitespace separated distances,
+// whole numbers from 0 to INT_MAX, with the team count taken from the
+// number of distances. Lines starting
+// with # are comments, except a line "# names: A B C ..." which names the
+// teams in order.
+// Binary caches hold the same distances and names, and are mapped straight
+// into memory instead of being parsed.
+typedef struct {
+	int num_teams;
+	// num_teams * num_teams distances, from team i to j at (i * num_teams) + j
+	int *distance;
+	// num_teams names followed by NULL, or NULL if the teams are unnamed
+	char **names;
+	// file the distances are mapped from, if any
+	void *map;
+	size_t map_len;
+} Instance;
+
+// kinds of generated instance
+// CIRC puts the teams around a circle, each one from its neighbours,
+// CON puts every team one from every other, EUCLID scatters them at random
+// over a square
+enum {INST_CIRC, INST_CON, INST_EUCLID};
+
+// Load an instance from a text file or binary cache
+// if cache is true, use filename.cache when it was made from filename as
+// it is now, the same size and modification time, else create it
+// returns NULL on failure
+Instance *LoadInstance(char *filename, bool cache);
+// Write an instance as a binary cache, returns false on failure
+// it can be loaded directly, but LoadInstance never takes it as the cache
+// of a text file
+bool WriteInstanceCache(Instance *inst, char *filename);
+// Generate an instance of kind for num_teams teams, seed places EUCLID teams
+Instance *MakeInstance(int kind, int num_teams, unsigned seed);
+// Write an instance in the text format, returns false on failure
+bool WriteInstance(Instance *inst, FILE *f);
+void DeleteInstance(Instance *inst);
+
+#endif /* INSTANCE_H */
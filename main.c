@@ -1,7 +1,14 @@
 #include "ttp.h"
+#include "instance.h"
+#include "sweep.h"
+#include "server.h"
+#include "trace.h"
 #include <argp.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
 
-enum {ERR_USAGE = 1, ERR_NTEAM, ERR_FILENAME, ERR_GENSCHED, ERR_REQS};
+enum {ERR_USAGE = 1, ERR_NTEAM, ERR_FILENAME, ERR_GENSCHED, ERR_REQS, ERR_SWEEP, ERR_SERVE, ERR_THREAD};
 
 const char *argp_program_version = 
 	"rdb-ttp v1.0";
@@ -9,9 +16,10 @@ const char *argp_program_bug_address =
 	"<rsardb11@vt.edu>";
 /* Program documentation */
 static char doc[] = 
-	"rdb-ttp -- a c implementation of the travelling team problem";
+	"rdb-ttp -- a c implementation of the travelling team problem\n"
+	"Solves data/NLNUMTEAMS.data, or the instance given with --instance";
 
-static char args_doc[] = "NUMTEAMS";
+static char args_doc[] = "[NUMTEAMS]";
 
 static struct argp_option options[] = {
 	{ "seed", 's', "seed", 0, "Starting seed" },
@@ -22,20 +30,80 @@ static struct argp_option options[] = {
 	{ "max-reheat", 'r', "reheat", 0, "Maximum reheat value" },
 	{ "max-phase", 'p', "phase", 0, "Maximum phase value" },
 	{ "max-counter", 'c', "counter", 0, "Maxmimum counter value" },
+	{ "instance", 'f', "file", 0, "Instance file to solve, text or a binary cache" },
+	{ "cache", 'C', 0, 0, "Load the instance from a binary cache next to it, "
+			"creating the cache if it is missing or out of date" },
+	{ "make", 'm', "kind", 0, "Write an instance of NUMTEAMS teams to stdout instead "
+			"of solving, circ (CIRCn), con (CONn) or euclid (random, placed by seed)" },
+	{ "sweep", 'S', "spec", 0, "Run every combination of settings in the grid spec file "
+			"on the thread pool, overriding the other settings" },
+	{ "results", 'o', "file", 0, "File to write sweep results to (default results.csv)" },
+	{ "stats", 'i', "file", OPTION_ARG_OPTIONAL, "Print counters for each type of move "
+			"(needs a STATS build), or write them to file as JSON" },
 	{ "Print", 'P', 0, 0, "Print the final schedule" },
 	{ "verbose", 'v', 0, 0, "Print the settings used to anneal" },
 	{ "update", 'u', 0, 0, "Print the progress of the annealing occasionally" },
+	{ "replicas", 'x', "replicas", 0, "Use parallel tempering with this many chains, "
+			"each on its own thread, instead of annealing" },
+	{ "generator", 'g', "name", 0, "Starting schedule generator, auto (default, "
+			"backtrack up to 32 teams, circle above), backtrack or circle" },
+	{ "moves", 'M', "policy", 0, "How moves are picked, uniform (default) or adaptive, "
+			"favouring the moves that have improved the most per nanosecond spent" },
+	{ "checkpoint", 'k', "file", 0, "Write a checkpoint of the annealing to file "
+			"periodically, to carry on from with --resume" },
+	{ "checkpoint-every", 'K', "seconds", 0, "Seconds between checkpoints (default 60)" },
+	{ "resume", 'R', "file", 0, "Carry on annealing from a checkpoint, with the "
+			"settings it was written with, on the same instance and a machine and "
+			"build of the same word size and byte order" },
+	{ "time-limit", 'T', "seconds", 0, "Stop annealing after this many seconds, "
+			"keeping the best schedule found so far" },
+	{ "gap", 'G', "percent", 0, "Stop once the best schedule costs at most this many "
+			"percent more than the lower bound (default 0, only at the bound itself)" },
+	{ "trace", 'E', "file", 0, "Write a sample of the annealing every --trace-every "
+			"moves to file, as CSV if it ends in .csv, else binary (the coldest chain "
+			"when tempering, the first run with --threads)" },
+	{ "trace-every", 'e', "moves", 0, "Moves between trace samples (default 10000)" },
+	{ "stream", 'B', 0, 0, "Print each new best feasible cost as it is found, "
+			"with the seconds since annealing started" },
+	{ "threads", 'j', "threads", 0, "Number of independent runs to anneal in parallel, "
+			"each with the next seed, or of requests to solve at once when serving "
+			"(default 1, or one per CPU when serving)" },
+	{ "serve", 'L', "socket", OPTION_ARG_OPTIONAL, "Keep running and solve requests, one "
+			"JSON object per line, read from stdin or from clients of the Unix socket "
+			"given, instead of solving once" },
 	{ 0 }
 };
 
 struct arguments {
 	unsigned num_teams;
 	unsigned seed;
-	bool print, verbose;
+	unsigned threads;
+	char *instance, *sweep, *results, *stats_file, *resume, *socket, *trace;
+	bool print, verbose, stats, cache, serve;
+	int make;
 	Settings *settings;
 };
 
-static bool PRINT_SCHEDULE;
+// Best feasible cost over every run, shared by the runs through progress_data
+typedef struct {
+	pthread_mutex_t lock;
+	// 0 until one is found
+	unsigned long cost;
+} Best;
+
+// print each new best feasible cost of all the runs, with the seconds since
+// the run that found it started annealing
+static bool PrintBest(void *data, unsigned long cost, double seconds) {
+	Best *best = data;
+	pthread_mutex_lock(&best->lock);
+	if (!best->cost || cost < best->cost) {
+		best->cost = cost;
+		printf("Best %.3f %lu\n", seconds, cost);
+		fflush(stdout);
+	}
+	pthread_mutex_unlock(&best->lock);
+	return true;
+}
 
 static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 	struct arguments *args = state->input;
@@ -97,6 +165,115 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 				return ERR_USAGE;
 			}
 			break;
+		case 'x':
+			args->settings->replicas = strtoul(arg, &ptr, 10);
+			if (ptr == arg || args->settings->replicas == 0 || \
+					args->settings->replicas > MAX_REPLICAS) {
+				printf("Error: Replicas must be a positive integer up to %d\n", MAX_REPLICAS);
+				return ERR_USAGE;
+			}
+			break;
+		case 'g':
+			if (!strcmp(arg, "auto")) {
+				args->settings->generator = GEN_AUTO;
+			} else if (!strcmp(arg, "backtrack")) {
+				args->settings->generator = GEN_BACKTRACK;
+			} else if (!strcmp(arg, "circle")) {
+				args->settings->generator = GEN_CIRCLE;
+			} else {
+				printf("Error: Generator must be auto, backtrack or circle\n");
+				return ERR_USAGE;
+			}
+			break;
+		case 'M':
+			if (!strcmp(arg, "uniform")) {
+				args->settings->policy = POLICY_UNIFORM;
+			} else if (!strcmp(arg, "adaptive")) {
+				args->settings->policy = POLICY_ADAPTIVE;
+			} else {
+				printf("Error: Move policy must be uniform or adaptive\n");
+				return ERR_USAGE;
+			}
+			break;
+		case 'k':
+			args->settings->checkpoint = arg;
+			break;
+		case 'K':
+			args->settings->checkpoint_every = strtoul(arg, &ptr, 10);
+			if (ptr == arg) {
+				printf("Error: Seconds between checkpoints must be an integer\n");
+				return ERR_USAGE;
+			}
+			break;
+		case 'R':
+			args->resume = arg;
+			break;
+		case 'T':
+			args->settings->time_limit = strtod(arg, &ptr);
+			if (ptr == arg || args->settings->time_limit <= 0) {
+				printf("Error: Time limit must be a positive float\n");
+				return ERR_USAGE;
+			}
+			break;
+		case 'G':
+			args->settings->gap = strtod(arg, &ptr);
+			if (ptr == arg || args->settings->gap < 0) {
+				printf("Error: Gap must be a float greater than or equal to 0\n");
+				return ERR_USAGE;
+			}
+			break;
+		case 'E':
+			args->trace = arg;
+			break;
+		case 'e':
+			args->settings->trace_every = strtoul(arg, &ptr, 10);
+			if (ptr == arg || args->settings->trace_every == 0) {
+				printf("Error: Moves between trace samples must be a positive integer\n");
+				return ERR_USAGE;
+			}
+			break;
+		case 'B':
+			args->settings->progress = PrintBest;
+			break;
+		case 'j':
+			args->threads = strtoul(arg, &ptr, 10);
+			if (ptr == arg || args->threads == 0) {
+				printf("Error: Threads must be a positive integer\n");
+				return ERR_USAGE;
+			}
+			break;
+		case 'L':
+			args->serve = true;
+			args->socket = arg;
+			break;
+		case 'f':
+			args->instance = arg;
+			break;
+		case 'C':
+			args->cache = true;
+			break;
+		case 'm':
+			if (!strcmp(arg, "circ")) {
+				args->make = INST_CIRC;
+			} else if (!strcmp(arg, "con")) {
+				args->make = INST_CON;
+			} else if (!strcmp(arg, "euclid")) {
+				args->make = INST_EUCLID;
+			} else {
+				printf("Error: Instance kind must be circ, con or euclid\n");
+				return ERR_USAGE;
+			}
+			break;
+		case 'S':
+			args->sweep = arg;
+			break;
+		case 'o':
+			args->results = arg;
+			break;
+		case 'i':
+			args->stats = true;
+			args->stats_file = arg;
+			break;
 		case 'P':
 			args->print = true;
 			break;
@@ -114,10 +291,13 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 			if (ptr == arg || args->num_teams < 3 || args->num_teams % 2) {
 				printf("Error: Number of teams must be even and greater than 3\n");
 				return ERR_NTEAM;
+			} else if (args->num_teams > MAX_TEAMS) {
+				printf("Error: At most %d teams, build with WIDE_CELLS=1 for more\n", MAX_TEAMS);
+				return ERR_NTEAM;
 			}
 			break;
 		case ARGP_KEY_END:
-			if (state->arg_num < 1) {
+			if (state->arg_num < 1 && !args->serve && (!args->instance || args->make >= 0)) {
 				argp_usage(state);
 			}
 			break;
@@ -131,102 +311,297 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 static struct argp argp = { options, parse_opt, args_doc, doc };
 
 
-unsigned GetArgs(int argc, char **argv, unsigned *num_teams, Settings *settings) {
-	struct arguments arguments;
+unsigned GetArgs(int argc, char **argv, struct arguments *arguments, Settings *settings) {
 	int retval;
 	// defaults
-	arguments.seed = 0;
-	arguments.num_teams = 0;
-	arguments.print = false;
-	arguments.verbose = false;
-	arguments.settings = settings;
-	settings->temp = 400;
-	settings->beta = 0.9999; 
-	settings->weight = 4000;
-	settings->theta = settings->delta = 1.04; 
-	settings->max_reheat = 10;
-	settings->max_phase = 7100;
-	settings->max_counter = 5000;
-	settings->update = false;
-
-	if ((retval = argp_parse(&argp, argc, argv, 0, 0, &arguments))) {
+	arguments->seed = 0;
+	// 0 until given, as the default depends on what is run
+	arguments->threads = 0;
+	arguments->instance = NULL;
+	arguments->cache = false;
+	arguments->make = -1;
+	arguments->sweep = NULL;
+	arguments->resume = NULL;
+	arguments->serve = false;
+	arguments->socket = NULL;
+	arguments->trace = NULL;
+	arguments->results = "results.csv";
+	arguments->stats = false;
+	arguments->stats_file = NULL;
+	arguments->num_teams = 0;
+	arguments->print = false;
+	arguments->verbose = false;
+	arguments->settings = settings;
+	TtpDefaultSettings(settings);
+
+	if ((retval = argp_parse(&argp, argc, argv, 0, 0, arguments))) {
 		return retval;
 	}
+	if ((settings->checkpoint || arguments->resume) && (arguments->threads > 1 || \
+			arguments->sweep || arguments->serve || settings->replicas)) {
+		printf("Error: Checkpoints are only for a single annealing run\n");
+		return ERR_USAGE;
+	}
+	// a job's CPU time is only its own thread's, tempering runs a thread per chain
+	if (arguments->sweep && settings->replicas) {
+		printf("Error: Sweeps are only for annealing, not tempering\n");
+		return ERR_USAGE;
+	}
+	if (arguments->trace && (arguments->sweep || arguments->serve)) {
+		printf("Error: Traces are only for solving once\n");
+		return ERR_USAGE;
+	}
 
-	PRINT_SCHEDULE = arguments.print;
-
-	srand(arguments.seed);
-
-	*num_teams = arguments.num_teams;
-	if (arguments.verbose) {
-		printf("Building schedule for %d teams with seed %d\n", \
-				arguments.num_teams, arguments.seed);
+	if (arguments->verbose && arguments->make < 0 && !arguments->serve) {
+		if (arguments->instance) {
+			printf("Building schedule for %s with seed %d\n", \
+					arguments->instance, arguments->seed);
+		} else {
+			printf("Building schedule for %d teams with seed %d\n", \
+					arguments->num_teams, arguments->seed);
+		}
 		printf("Settings:\n");
 		printf("Starting temp: %f\nBeta: %f\nWeight: %f\nTheta/Delta: %f\n"\
 				"Max Reheat: %d\nMax Phase: %d\nMax Counter: %d\n", \
 				settings->temp,	settings->beta, settings->weight, \
 				settings->theta, settings->max_reheat, settings->max_phase, \
 				settings->max_counter);
+		if (settings->replicas) {
+			printf("Replicas: %d\n", settings->replicas);
+		}
+		if (settings->time_limit) {
+			printf("Time Limit: %f\n", settings->time_limit);
+		}
+		if (settings->gap) {
+			printf("Gap: %f%%\n", settings->gap);
+		}
+		if (settings->policy == POLICY_ADAPTIVE) {
+			printf("Move Policy: adaptive\n");
+		}
 	}
 	return 0;
 }
 
+// A single annealing run on its own context
+typedef struct {
+	TtpContext *ctx;
+	Settings settings;
+	unsigned seed;
+	// checkpoint to carry on from instead of starting from seed, if not NULL
+	char *resume;
+	int invalid;
+	// run on the main thread, as a thread of its own couldn't be started
+	bool unthreaded;
+} Run;
+
+static void *DoRun(void *arg) {
+	Run *run = arg;
+	if (run->resume) {
+		run->invalid = TtpResume(run->ctx, run->resume, &run->settings, \
+				run->settings.progress, run->settings.progress_data);
+	} else {
+		run->invalid = TtpSolve(run->ctx, run->seed, &run->settings, \
+				run->settings.progress, run->settings.progress_data);
+	}
+	return NULL;
+}
+
 int main(int argc, char **argv) {
-	int invalid, retval;
-	unsigned num_teams;
-	char *filename;
-	Schedule *s;
+	int retval;
+	unsigned num_teams, seed, threads;
+	char *filename, *sweep, *results;
+	struct arguments arguments;
+	Instance *inst;
+	TtpContext *base;
 	Settings settings;
 
-	if ((retval = GetArgs(argc, argv, &num_teams, &settings))) {
+	if ((retval = GetArgs(argc, argv, &arguments, &settings))) {
+		return retval;
+	}
+	if (arguments.make >= 0) {
+		inst = MakeInstance(arguments.make, arguments.num_teams, arguments.seed);
+		retval = WriteInstance(inst, stdout) ? 0 : ERR_FILENAME;
+		DeleteInstance(inst);
 		return retval;
 	}
 
-	filename = calloc(snprintf(NULL, 0, "data/NL%d.data", num_teams) + 1, sizeof(*filename));
+	if (arguments.serve) {
+		threads = (arguments.threads) ? arguments.threads : sysconf(_SC_NPROCESSORS_ONLN);
+		return Serve(arguments.socket, threads, arguments.cache, settings) ? 0 : ERR_SERVE;
+	}
 
-	sprintf(filename, "data/NL%d.data", num_teams);
+	seed = arguments.seed;
+	threads = (arguments.threads) ? arguments.threads : 1;
+	sweep = arguments.sweep;
+	results = arguments.results;
 
-	s = CreateSchedule(num_teams);
-	GenerateSchedule(s);
-	if (!InitCost(s, filename)) {
+	if (arguments.instance) {
+		filename = strdup(arguments.instance);
+	} else {
+		filename = calloc(snprintf(NULL, 0, "data/NL%d.data", arguments.num_teams) + 1, \
+				sizeof(*filename));
+		sprintf(filename, "data/NL%d.data", arguments.num_teams);
+	}
+
+	inst = LoadInstance(filename, arguments.cache);
+	if (inst == NULL) {
 		printf("Unable to read file %s\n", filename);
 		free(filename);
-		DeleteSchedule(s);
 		return ERR_FILENAME;
 	} 
+	num_teams = inst->num_teams;
+	if (arguments.num_teams && num_teams != arguments.num_teams) {
+		printf("Error: %s has %d teams, not %d\n", filename, num_teams, arguments.num_teams);
+		free(filename);
+		DeleteInstance(inst);
+		return ERR_NTEAM;
+	} else if (num_teams < 3 || num_teams % 2) {
+		printf("Error: %s has %d teams, number of teams must be even and greater than 3\n", \
+				filename, num_teams);
+		free(filename);
+		DeleteInstance(inst);
+		return ERR_NTEAM;
+	} else if (num_teams > MAX_TEAMS) {
+		printf("Error: %s has %d teams, at most %d, build with WIDE_CELLS=1 for more\n", \
+				filename, num_teams, MAX_TEAMS);
+		free(filename);
+		DeleteInstance(inst);
+		return ERR_NTEAM;
+	}
+	free(filename);
 
+	// every run shares the instance's distances
+	base = TtpCreate(num_teams, inst->distance, (const char *const *) inst->names);
 
-	free(filename);
-	if (CheckHardReq(s)) {
-		printf("Invalid Schedule Generated\n");
-		DeleteSchedule(s);
-		return ERR_GENSCHED;
+	if (sweep) {
+		retval = Sweep(base, sweep, results, threads, settings) ? 0 : ERR_SWEEP;
+		TtpDelete(base);
+		DeleteInstance(inst);
+		return retval;
+	}
+
+	if (arguments.trace && (settings.trace = TraceOpen(arguments.trace)) == NULL) {
+		printf("Unable to write file %s\n", arguments.trace);
+		TtpDelete(base);
+		DeleteInstance(inst);
+		return ERR_FILENAME;
 	}
 
-	Anneal(s, settings);
-	invalid = CheckHardReq(s);
-	invalid |= CheckSoftReq(s, NULL);
-	if (invalid) {
-		if (invalid & SCHED_INVALID) {
+	Best best_cost = {PTHREAD_MUTEX_INITIALIZER, 0};
+	if (settings.progress == PrintBest) {
+		settings.progress_data = &best_cost;
+	}
+
+	Run *runs = calloc(threads, sizeof(*runs));
+	pthread_t *tids = calloc(threads, sizeof(*tids));
+	for (int i = 0; i < threads; i++) {
+		runs[i].ctx = TtpClone(base);
+		runs[i].settings = settings;
+		// only one run reports its progress
+		runs[i].settings.update = settings.update && i == 0;
+		runs[i].settings.trace = (i == 0) ? settings.trace : NULL;
+		runs[i].seed = seed + i;
+		runs[i].resume = arguments.resume;
+	}
+	if (threads == 1) {
+		DoRun(&runs[0]);
+	} else {
+		for (int i = 0; i < threads; i++) {
+			if (pthread_create(&tids[i], NULL, DoRun, &runs[i])) {
+				runs[i].unthreaded = true;
+				DoRun(&runs[i]);
+			}
+		}
+		for (int i = 0; i < threads; i++) {
+			if (!runs[i].unthreaded) {
+				pthread_join(tids[i], NULL);
+			}
+		}
+	}
+
+	if (settings.trace) {
+		unsigned long dropped = TraceClose(settings.trace);
+		if (dropped) {
+			printf("Trace dropped %lu samples, try a larger --trace-every\n", dropped);
+		}
+	}
+
+	// pick the cheapest valid schedule, or report on the first run
+	Run *best = &runs[0];
+	for (int i = 0; i < threads; i++) {
+		if (threads > 1 && arguments.verbose) {
+			if (runs[i].invalid & SCHED_GENERATE) {
+				printf("Seed %u: invalid schedule generated\n", runs[i].seed);
+			} else if (runs[i].invalid & SCHED_THREAD) {
+				printf("Seed %u: unable to start threads\n", runs[i].seed);
+			} else {
+				printf("Seed %u: %s cost %lu\n", runs[i].seed, \
+						(runs[i].invalid) ? "invalid" : "valid", \
+						TtpCost(runs[i].ctx));
+			}
+		}
+		if (runs[i].invalid) {
+			continue;
+		}
+		if (best->invalid || \
+				TtpCost(runs[i].ctx) < TtpCost(best->ctx)) {
+			best = &runs[i];
+		}
+	}
+
+	if (best->invalid & SCHED_RESUME) {
+		printf("Unable to read checkpoint %s\n", arguments.resume);
+		retval = ERR_FILENAME;
+	} else if (best->invalid & SCHED_GENERATE) {
+		printf("Invalid Schedule Generated\n");
+		retval = ERR_GENSCHED;
+	} else if (best->invalid & SCHED_THREAD) {
+		printf("Unable to start a thread for each of %u replicas\n", settings.replicas);
+		retval = ERR_THREAD;
+	} else if (best->invalid) {
+		if (best->invalid & SCHED_INVALID) {
 			printf("Schedule is invalid\n");
 		}
-		if (invalid & SCHED_ATMOST) {
+		if (best->invalid & SCHED_ATMOST) {
 			printf("Schedule violates atmost contraint.\n");
 		}
-		if (invalid & SCHED_REPEAT) {
+		if (best->invalid & SCHED_REPEAT) {
 			printf("Schedule violates repeat contraint.\n");
 		}
 		retval = ERR_REQS;
 	} else {
 		printf("Valid Schedule!\n");
-		printf("Cost: %lu\n", s->cost.total_cost);
-		if (PRINT_SCHEDULE) {
-			PrintSchedule(s, TEAM_NAMES);
+		printf("Cost: %lu\n", TtpCost(best->ctx));
+		unsigned long bound = TtpLowerBound(best->ctx);
+		if (bound) {
+			printf("Lower Bound: %lu\nGap: %.2f%%\n", bound, \
+					((double) (TtpCost(best->ctx) - bound) / bound) * 100);
+		}
+		if (arguments.print) {
+			PrintSchedule(TtpSchedule(best->ctx), (const char * const *) inst->names);
 		}
 		retval = 0;
 	}
 
-	DeleteSchedule(s);
+	if (arguments.stats && !(best->invalid & (SCHED_GENERATE | SCHED_RESUME | SCHED_THREAD))) {
+		FILE *fptr = (arguments.stats_file) ? fopen(arguments.stats_file, "w") : stdout;
+		if (fptr == NULL) {
+			printf("Unable to write file %s\n", arguments.stats_file);
+		} else {
+			PrintStats(TtpSchedule(best->ctx), fptr, arguments.stats_file != NULL);
+			if (fptr != stdout) {
+				fclose(fptr);
+			}
+		}
+	}
+
+	for (int i = 0; i < threads; i++) {
+		TtpDelete(runs[i].ctx);
+	}
+	free(tids);
+	free(runs);
+	TtpDelete(base);
+	DeleteInstance(inst);
 
 	return retval;
-}
\ No newline at end of file
+}
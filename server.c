@@ -0,0 +1,777 @@
+#include "server.h"
+#include "instance.h"
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define MAX_ID		64
+#define MAX_KEY		32
+#define MAX_PATH	4096
+// room for a file name and why it can't be used
+#define MAX_ERROR	(MAX_PATH + 128)
+// instances kept loaded at once, the least recently used that isn't being
+// solved makes way for a new one
+#define MAX_LOADED	64
+
+// Number valued fields of a request
+enum {FIELD_TEAMS, FIELD_SEED, FIELD_TIME_LIMIT, FIELD_TEMP, FIELD_BETA, FIELD_WEIGHT, \
+		FIELD_DELTA, FIELD_REHEAT, FIELD_PHASE, FIELD_COUNTER, FIELD_REPLICAS, \
+		FIELD_GAP, NUM_FIELDS};
+
+static const char *const FIELD_NAMES[] = {
+		"teams", "seed", "time_limit", "temp", "beta", "weight", \
+		"delta", "reheat", "phase", "counter", "replicas", \
+		"gap", 0
+};
+
+// An instance kept loaded between requests
+typedef struct {
+	char *filename;
+	Instance *inst;
+	// cloned for each run, sharing the distances and their lower bound
+	TtpContext *ctx;
+	// requests solving it, it can only be dropped at 0
+	unsigned refs;
+	// when it was last asked for, from Server.uses
+	unsigned long used;
+} Loaded;
+
+struct Server;
+
+// Where requests come from and answers go, stdin and stdout or a connection
+typedef struct {
+	struct Server *server;
+	FILE *in;
+	int out;
+	// the connection, closed once nothing is pending, -1 for stdout
+	int fd;
+	// held while writing an answer, so lines from the workers don't mix
+	pthread_mutex_t lock;
+	// requests not yet answered, and one more while still reading
+	int pending;
+} Client;
+
+// A single solve request
+typedef struct Request {
+	struct Request *next;
+	Client *client;
+	// as it was given, to echo back in the answer, empty if none was
+	char id[MAX_ID + 1];
+	char filename[MAX_PATH];
+	unsigned seed;
+	Settings settings;
+} Request;
+
+typedef struct Server {
+	// for anything a request doesn't give
+	Settings settings;
+	bool cache;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	// waiting requests, oldest first
+	Request *head;
+	Request *tail;
+	// no more requests are coming, the workers stop once the queue is empty
+	bool closing;
+	// guards the loaded instances
+	pthread_mutex_t load_lock;
+	Loaded *loaded[MAX_LOADED];
+	int num_loaded;
+	// instances asked for so far
+	unsigned long uses;
+} Server;
+
+// Where parsing a request line is up to
+typedef struct {
+	char *p;
+	char error[MAX_ERROR];
+} Parser;
+
+static long __Nanoseconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000L) + ts.tv_nsec;
+}
+
+static Client *NewClient(Server *server, FILE *in, int out, int fd) {
+	Client *c = calloc(1, sizeof(*c));
+	c->server = server;
+	c->in = in;
+	c->out = out;
+	c->fd = fd;
+	pthread_mutex_init(&c->lock, NULL);
+	c->pending = 1;
+	return c;
+}
+
+// drop a reference to c, closing and freeing it with the last
+static void ReleaseClient(Client *c) {
+	pthread_mutex_lock(&c->lock);
+	bool last = --c->pending == 0;
+	pthread_mutex_unlock(&c->lock);
+	if (last) {
+		if (c->fd >= 0) {
+			close(c->fd);
+		}
+		pthread_mutex_destroy(&c->lock);
+		free(c);
+	}
+}
+
+// write a whole answer to c, dropping it if c has gone away
+static void Answer(Client *c, char *buf, size_t len) {
+	pthread_mutex_lock(&c->lock);
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = write(c->out, buf + done, len - done);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0) {
+			break;
+		}
+		done += n;
+	}
+	pthread_mutex_unlock(&c->lock);
+}
+
+// write str as a JSON string
+static void __WriteString(FILE *f, const char *str) {
+	fputc('"', f);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\') {
+			fprintf(f, "\\%c", *str);
+		} else if ((unsigned char) *str < 0x20) {
+			fprintf(f, "\\u%04x", *str);
+		} else {
+			fputc(*str, f);
+		}
+	}
+	fputc('"', f);
+}
+
+static void AnswerError(Client *c, char *id, char *error) {
+	char *buf;
+	size_t len;
+	FILE *f = open_memstream(&buf, &len);
+	fprintf(f, "{\"id\": %s, \"status\": \"error\", \"error\": ", (id[0]) ? id : "null");
+	__WriteString(f, error);
+	fprintf(f, "}\n");
+	fclose(f);
+	Answer(c, buf, len);
+	free(buf);
+}
+
+// answer req with the schedule ctx was solved to, and what is wrong with it
+// if invalid
+static void AnswerSchedule(Request *req, TtpContext *ctx, int invalid, double seconds) {
+	char *buf;
+	size_t len;
+	FILE *f = open_memstream(&buf, &len);
+	unsigned long cost = TtpCost(ctx), bound = TtpLowerBound(ctx);
+	fprintf(f, "{\"id\": %s, \"status\": \"ok\", \"valid\": %s, \"cost\": %lu, " \
+			"\"lower_bound\": %lu, ", (req->id[0]) ? req->id : "null", \
+			(invalid) ? "false" : "true", cost, bound);
+	if (bound) {
+		fprintf(f, "\"gap\": %.4f, ", \
+				((double) ((long) cost - (long) bound) / bound) * 100);
+	}
+	fprintf(f, "\"seconds\": %.6f, \"moves\": %lu, \"violations\": [%s%s%s%s%s], " \
+			"\"schedule\": [", seconds, TtpSchedule(ctx)->num_moves, \
+			(invalid & SCHED_INVALID) ? "\"invalid\"" : "", \
+			((invalid & SCHED_INVALID) && (invalid & (SCHED_ATMOST | SCHED_REPEAT))) ? \
+			", " : "", (invalid & SCHED_ATMOST) ? "\"atmost\"" : "", \
+			((invalid & SCHED_ATMOST) && (invalid & SCHED_REPEAT)) ? ", " : "", \
+			(invalid & SCHED_REPEAT) ? "\"repeat\"" : "");
+	for (int r = 0; r < TtpNumRounds(ctx); r++) {
+		fprintf(f, (r) ? ", [" : "[");
+		for (int t = 1; t <= TtpNumTeams(ctx); t++) {
+			fprintf(f, (t > 1) ? ", %d" : "%d", TtpOpponent(ctx, r, t));
+		}
+		fprintf(f, "]");
+	}
+	fprintf(f, "]}\n");
+	fclose(f);
+	Answer(req->client, buf, len);
+	free(buf);
+}
+
+static void __SkipSpace(Parser *ps) {
+	while (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\r' || *ps->p == '\n') {
+		ps->p++;
+	}
+}
+
+// parse a JSON string into out, of at most len - 1 chars
+static bool __ParseString(Parser *ps, char *out, size_t len) {
+	__SkipSpace(ps);
+	if (*ps->p != '"') {
+		snprintf(ps->error, MAX_ERROR, "Expected a string");
+		return false;
+	}
+	ps->p++;
+	size_t n = 0;
+	while (*ps->p != '"') {
+		char c = *ps->p++;
+		if (c == '\0') {
+			snprintf(ps->error, MAX_ERROR, "Unterminated string");
+			return false;
+		} else if (c == '\\') {
+			switch (c = *ps->p++) {
+				case '"':
+				case '\\':
+				case '/':
+					break;
+				case 't':
+					c = '\t';
+					break;
+				case 'n':
+					c = '\n';
+					break;
+				default:
+					snprintf(ps->error, MAX_ERROR, "Unsupported escape in string");
+					return false;
+			}
+		}
+		if (n + 1 >= len) {
+			snprintf(ps->error, MAX_ERROR, "String too long");
+			return false;
+		}
+		out[n++] = c;
+	}
+	ps->p++;
+	out[n] = '\0';
+	return true;
+}
+
+static bool __ParseNumber(Parser *ps, double *val) {
+	__SkipSpace(ps);
+	char *ptr;
+	// strtod would take inf and nan too
+	bool digit = *ps->p == '-' || (*ps->p >= '0' && *ps->p <= '9');
+	*val = strtod(ps->p, &ptr);
+	if (!digit || ptr == ps->p) {
+		snprintf(ps->error, MAX_ERROR, "Expected a number");
+		return false;
+	}
+	ps->p = ptr;
+	return true;
+}
+
+// parse an id, a number or a string, keeping it as it was written
+static bool __ParseId(Parser *ps, Request *req) {
+	__SkipSpace(ps);
+	char *start = ps->p;
+	char str[MAX_ID + 1];
+	double val;
+	if (!((*ps->p == '"') ? __ParseString(ps, str, sizeof(str)) : __ParseNumber(ps, &val))) {
+		snprintf(ps->error, MAX_ERROR, "Id must be a number or a string");
+		return false;
+	} else if (ps->p - start > MAX_ID) {
+		snprintf(ps->error, MAX_ERROR, "Id longer than %d characters", MAX_ID);
+		return false;
+	}
+	memcpy(req->id, start, ps->p - start);
+	req->id[ps->p - start] = '\0';
+	return true;
+}
+
+// check a value for a field is in range, same limits as the command line
+// except that replicas may be 0 to anneal and time_limit 0 for no limit
+// bounds are checked before casting, a value out of range of the cast is
+// undefined
+static bool CheckField(int field, double val) {
+	switch (field) {
+		case FIELD_TEAMS:
+			return val >= 4 && val <= MAX_TEAMS && val == (int) val && !((int) val % 2);
+		case FIELD_TEMP:
+		case FIELD_WEIGHT:
+			return val > 0;
+		case FIELD_BETA:
+			return val > 0 && val < 1;
+		case FIELD_DELTA:
+			return val > 1;
+		case FIELD_TIME_LIMIT:
+		case FIELD_GAP:
+			return val >= 0;
+		case FIELD_SEED:
+			return val >= 0 && val <= UINT_MAX && val == (unsigned) val;
+		case FIELD_REPLICAS:
+			return val >= 0 && val <= MAX_REPLICAS && val == (unsigned) val;
+		default:
+			return val > 0 && val <= UINT_MAX && val == (unsigned) val;
+	}
+}
+
+static bool __ParseObject(Parser *ps, Request *req, bool nested);
+
+// parse the value of field key into req
+// id, instance and settings are only allowed at the top, not in settings
+static bool __ParseField(Parser *ps, Request *req, char *key, bool nested) {
+	Settings *settings = &req->settings;
+	if (!nested && !strcmp(key, "id")) {
+		return __ParseId(ps, req);
+	} else if (!nested && !strcmp(key, "instance")) {
+		return __ParseString(ps, req->filename, sizeof(req->filename));
+	} else if (!nested && !strcmp(key, "settings")) {
+		return __ParseObject(ps, req, true);
+	} else if (!strcmp(key, "generator") || !strcmp(key, "moves")) {
+		char name[MAX_KEY];
+		if (!__ParseString(ps, name, sizeof(name))) {
+			return false;
+		}
+		if (!strcmp(key, "generator") && !strcmp(name, "auto")) {
+			settings->generator = GEN_AUTO;
+		} else if (!strcmp(key, "generator") && !strcmp(name, "backtrack")) {
+			settings->generator = GEN_BACKTRACK;
+		} else if (!strcmp(key, "generator") && !strcmp(name, "circle")) {
+			settings->generator = GEN_CIRCLE;
+		} else if (!strcmp(key, "moves") && !strcmp(name, "uniform")) {
+			settings->policy = POLICY_UNIFORM;
+		} else if (!strcmp(key, "moves") && !strcmp(name, "adaptive")) {
+			settings->policy = POLICY_ADAPTIVE;
+		} else {
+			snprintf(ps->error, MAX_ERROR, "Invalid value %s for %s", name, key);
+			return false;
+		}
+		return true;
+	}
+
+	int field;
+	for (field = 0; FIELD_NAMES[field]; field++) {
+		if (!strcmp(key, FIELD_NAMES[field])) {
+			break;
+		}
+	}
+	if (!FIELD_NAMES[field]) {
+		snprintf(ps->error, MAX_ERROR, "Unknown field %s", key);
+		return false;
+	}
+	double val;
+	if (!__ParseNumber(ps, &val)) {
+		return false;
+	} else if (!CheckField(field, val)) {
+		snprintf(ps->error, MAX_ERROR, "Invalid value for %s", key);
+		return false;
+	}
+	switch (field) {
+		case FIELD_TEAMS:
+			snprintf(req->filename, sizeof(req->filename), "data/NL%d.data", (int) val);
+			break;
+		case FIELD_SEED:
+			req->seed = val;
+			break;
+		case FIELD_TIME_LIMIT:
+			settings->time_limit = val;
+			break;
+		case FIELD_TEMP:
+			settings->temp = val;
+			break;
+		case FIELD_BETA:
+			settings->beta = val;
+			break;
+		case FIELD_WEIGHT:
+			settings->weight = val;
+			break;
+		case FIELD_DELTA:
+			settings->delta = settings->theta = val;
+			break;
+		case FIELD_REHEAT:
+			settings->max_reheat = val;
+			break;
+		case FIELD_PHASE:
+			settings->max_phase = val;
+			break;
+		case FIELD_COUNTER:
+			settings->max_counter = val;
+			break;
+		case FIELD_REPLICAS:
+			settings->replicas = val;
+			break;
+		case FIELD_GAP:
+			settings->gap = val;
+			break;
+	}
+	return true;
+}
+
+static bool __ParseObject(Parser *ps, Request *req, bool nested) {
+	__SkipSpace(ps);
+	if (*ps->p != '{') {
+		snprintf(ps->error, MAX_ERROR, "Expected an object");
+		return false;
+	}
+	ps->p++;
+	__SkipSpace(ps);
+	if (*ps->p == '}') {
+		ps->p++;
+		return true;
+	}
+	while (true) {
+		char key[MAX_KEY];
+		if (!__ParseString(ps, key, sizeof(key))) {
+			return false;
+		}
+		__SkipSpace(ps);
+		if (*ps->p != ':') {
+			snprintf(ps->error, MAX_ERROR, "Expected : after %s", key);
+			return false;
+		}
+		ps->p++;
+		if (!__ParseField(ps, req, key, nested)) {
+			return false;
+		}
+		__SkipSpace(ps);
+		if (*ps->p == '}') {
+			ps->p++;
+			return true;
+		} else if (*ps->p != ',') {
+			snprintf(ps->error, MAX_ERROR, "Expected , or } after %s", key);
+			return false;
+		}
+		ps->p++;
+	}
+}
+
+// parse a whole request line into req
+static bool ParseRequest(Parser *ps, Request *req) {
+	if (!__ParseObject(ps, req, false)) {
+		return false;
+	}
+	__SkipSpace(ps);
+	if (*ps->p) {
+		snprintf(ps->error, MAX_ERROR, "Unexpected text after the request");
+		return false;
+	} else if (!req->filename[0]) {
+		snprintf(ps->error, MAX_ERROR, "No instance or teams given");
+		return false;
+	}
+	return true;
+}
+
+// the loaded instance from filename, NULL if it is not loaded yet
+// load_lock must be held
+static Loaded *__FindLoaded(Server *server, char *filename) {
+	for (int i = 0; i < server->num_loaded; i++) {
+		if (!strcmp(server->loaded[i]->filename, filename)) {
+			return server->loaded[i];
+		}
+	}
+	return NULL;
+}
+
+static void __DeleteLoaded(Loaded *l) {
+	TtpDelete(l->ctx);
+	DeleteInstance(l->inst);
+	free(l->filename);
+	free(l);
+}
+
+// l asked for again by a request, load_lock must be held
+static inline Loaded *__UseLoaded(Server *server, Loaded *l) {
+	l->refs++;
+	l->used = ++server->uses;
+	return l;
+}
+
+// make room for another instance if there are MAX_LOADED, dropping the least
+// recently used that isn't being solved
+// load_lock must be held
+// returns false if every one is being solved
+static bool __MakeRoom(Server *server) {
+	if (server->num_loaded < MAX_LOADED) {
+		return true;
+	}
+	int lru = -1;
+	for (int i = 0; i < server->num_loaded; i++) {
+		Loaded *l = server->loaded[i];
+		if (!l->refs && (lru < 0 || l->used < server->loaded[lru]->used)) {
+			lru = i;
+		}
+	}
+	if (lru < 0) {
+		return false;
+	}
+	__DeleteLoaded(server->loaded[lru]);
+	server->loaded[lru] = server->loaded[--server->num_loaded];
+	return true;
+}
+
+// the loaded instance from filename, loading it the first time, to be
+// released once the request is done with it
+// loading and its lower bound take a while, so they are done without
+// load_lock, and if another thread loaded it meanwhile its copy is kept
+// returns NULL with the reason in error if it can't be used
+static Loaded *Load(Server *server, char *filename, char *error) {
+	pthread_mutex_lock(&server->load_lock);
+	Loaded *l = __FindLoaded(server, filename);
+	if (l) {
+		__UseLoaded(server, l);
+	}
+	pthread_mutex_unlock(&server->load_lock);
+	if (l) {
+		return l;
+	}
+
+	Instance *inst = LoadInstance(filename, server->cache);
+	if (inst == NULL) {
+		snprintf(error, MAX_ERROR, "Unable to read file %s", filename);
+		return NULL;
+	} else if (inst->num_teams < 4 || inst->num_teams % 2) {
+		snprintf(error, MAX_ERROR, "%s has %d teams, number of teams must be even and " \
+				"greater than 3", filename, inst->num_teams);
+		DeleteInstance(inst);
+		return NULL;
+	} else if (inst->num_teams > MAX_TEAMS) {
+		snprintf(error, MAX_ERROR, "%s has %d teams, at most %d", filename, \
+				inst->num_teams, MAX_TEAMS);
+		DeleteInstance(inst);
+		return NULL;
+	}
+	TtpContext *ctx = TtpCreate(inst->num_teams, inst->distance, \
+			(const char *const *) inst->names);
+
+	pthread_mutex_lock(&server->load_lock);
+	if ((l = __FindLoaded(server, filename))) {
+		__UseLoaded(server, l);
+		pthread_mutex_unlock(&server->load_lock);
+		TtpDelete(ctx);
+		DeleteInstance(inst);
+		return l;
+	}
+	if (!__MakeRoom(server)) {
+		pthread_mutex_unlock(&server->load_lock);
+		snprintf(error, MAX_ERROR, "Already solving %d instances, the most kept " \
+				"loaded", MAX_LOADED);
+		TtpDelete(ctx);
+		DeleteInstance(inst);
+		return NULL;
+	}
+	l = calloc(1, sizeof(*l));
+	l->filename = strdup(filename);
+	l->inst = inst;
+	l->ctx = ctx;
+	server->loaded[server->num_loaded++] = __UseLoaded(server, l);
+	pthread_mutex_unlock(&server->load_lock);
+	return l;
+}
+
+// a request is done with l, so it can be dropped
+static void Release(Server *server, Loaded *l) {
+	pthread_mutex_lock(&server->load_lock);
+	l->refs--;
+	pthread_mutex_unlock(&server->load_lock);
+}
+
+// solve req on its own copy of the instance and answer it
+static void RunRequest(Server *server, Request *req) {
+	char error[MAX_ERROR];
+	Loaded *l = Load(server, req->filename, error);
+	if (l == NULL) {
+		AnswerError(req->client, req->id, error);
+		return;
+	}
+	TtpContext *ctx = TtpClone(l->ctx);
+	long start = __Nanoseconds();
+	int invalid = TtpSolve(ctx, req->seed, &req->settings, NULL, NULL);
+	double seconds = (__Nanoseconds() - start) / 1e9;
+	if (invalid & SCHED_GENERATE) {
+		AnswerError(req->client, req->id, "Invalid schedule generated");
+	} else if (invalid & SCHED_THREAD) {
+		AnswerError(req->client, req->id, "Unable to start a thread for each replica");
+	} else {
+		AnswerSchedule(req, ctx, invalid, seconds);
+	}
+	TtpDelete(ctx);
+	Release(server, l);
+}
+
+static void *DoWork(void *arg) {
+	Server *server = arg;
+	while (true) {
+		pthread_mutex_lock(&server->lock);
+		while (!server->head && !server->closing) {
+			pthread_cond_wait(&server->ready, &server->lock);
+		}
+		Request *req = server->head;
+		if (req) {
+			server->head = req->next;
+			if (!server->head) {
+				server->tail = NULL;
+			}
+		}
+		pthread_mutex_unlock(&server->lock);
+		if (!req) {
+			break;
+		}
+		RunRequest(server, req);
+		ReleaseClient(req->client);
+		free(req);
+	}
+	return NULL;
+}
+
+// read requests from c to the end of its input, queueing each for the
+// workers, and answering the ones that can't be parsed straight away
+static void ReadRequests(Client *c) {
+	Server *server = c->server;
+	char *line = NULL;
+	size_t size = 0;
+	while (getline(&line, &size, c->in) >= 0) {
+		Parser ps = {line, ""};
+		__SkipSpace(&ps);
+		if (!*ps.p) {
+			continue;
+		}
+		Request *req = calloc(1, sizeof(*req));
+		req->client = c;
+		req->settings = server->settings;
+		if (!ParseRequest(&ps, req)) {
+			AnswerError(c, req->id, ps.error);
+			free(req);
+			continue;
+		}
+		pthread_mutex_lock(&c->lock);
+		c->pending++;
+		pthread_mutex_unlock(&c->lock);
+
+		pthread_mutex_lock(&server->lock);
+		if (server->tail) {
+			server->tail->next = req;
+		} else {
+			server->head = req;
+		}
+		server->tail = req;
+		pthread_cond_signal(&server->ready);
+		pthread_mutex_unlock(&server->lock);
+	}
+	free(line);
+}
+
+// thread for a single socket connection
+static void *DoClient(void *arg) {
+	Client *c = arg;
+	ReadRequests(c);
+	fclose(c->in);
+	ReleaseClient(c);
+	return NULL;
+}
+
+// accept connections on socket_path, each read on its own thread
+// only returns, with false, if the socket can't be opened or stops accepting
+static bool Listen(Server *server, char *socket_path) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		printf("Error: Socket path %s is too long\n", socket_path);
+		return false;
+	}
+	strcpy(addr.sun_path, socket_path);
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	// one left behind by an earlier server
+	unlink(socket_path);
+	if (listener < 0 || bind(listener, (struct sockaddr *) &addr, sizeof(addr)) || \
+			listen(listener, SOMAXCONN)) {
+		printf("Unable to open socket %s\n", socket_path);
+		if (listener >= 0) {
+			close(listener);
+		}
+		return false;
+	}
+	fprintf(stderr, "Serving on %s\n", socket_path);
+	while (true) {
+		int fd = accept(listener, NULL, NULL);
+		if (fd < 0 && (errno == EINTR || errno == ECONNABORTED)) {
+			continue;
+		} else if (fd < 0) {
+			printf("Unable to accept on socket %s\n", socket_path);
+			break;
+		}
+		// read through a stream of its own, so closing it leaves fd for the answers
+		int in = dup(fd);
+		FILE *f = (in >= 0) ? fdopen(in, "r") : NULL;
+		if (f == NULL) {
+			if (in >= 0) {
+				close(in);
+			}
+			close(fd);
+			continue;
+		}
+		Client *c = NewClient(server, f, fd, fd);
+		pthread_t tid;
+		if (pthread_create(&tid, NULL, DoClient, c)) {
+			fclose(f);
+			ReleaseClient(c);
+			continue;
+		}
+		pthread_detach(tid);
+	}
+	close(listener);
+	unlink(socket_path);
+	return false;
+}
+
+bool Serve(char *socket_path, unsigned threads, bool cache, Settings settings) {
+	// connections may still be reading from it if listening fails part way,
+	// so it is left to the end of the process
+	Server *server = calloc(1, sizeof(*server));
+	settings.update = false;
+	settings.checkpoint = NULL;
+	settings.progress = NULL;
+	settings.trace = NULL;
+	server->settings = settings;
+	server->cache = cache;
+	pthread_mutex_init(&server->lock, NULL);
+	pthread_cond_init(&server->ready, NULL);
+	pthread_mutex_init(&server->load_lock, NULL);
+	// answers to clients that have gone are dropped, not fatal
+	signal(SIGPIPE, SIG_IGN);
+
+	// serve with as many workers as could be started
+	pthread_t *tids = calloc(threads, sizeof(*tids));
+	unsigned started = 0;
+	while (started < threads && !pthread_create(&tids[started], NULL, DoWork, server)) {
+		started++;
+	}
+	threads = started;
+	if (!threads) {
+		printf("Unable to start any threads\n");
+		free(tids);
+		return false;
+	}
+	if (socket_path) {
+		Listen(server, socket_path);
+	} else {
+		Client *c = NewClient(server, stdin, STDOUT_FILENO, -1);
+		ReadRequests(c);
+		ReleaseClient(c);
+	}
+
+	// finish what is queued
+	pthread_mutex_lock(&server->lock);
+	server->closing = true;
+	pthread_cond_broadcast(&server->ready);
+	pthread_mutex_unlock(&server->lock);
+	for (unsigned i = 0; i < threads; i++) {
+		pthread_join(tids[i], NULL);
+	}
+	free(tids);
+	if (socket_path) {
+		return false;
+	}
+
+	for (int i = 0; i < server->num_loaded; i++) {
+		__DeleteLoaded(server->loaded[i]);
+	}
+	pthread_mutex_destroy(&server->load_lock);
+	pthread_cond_destroy(&server->ready);
+	pthread_mutex_destroy(&server->lock);
+	free(server);
+	return true;
+}
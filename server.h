@@ -0,0 +1,30 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "ttp.h"
+
+// Solver service, answering solve requests on a pool of threads
+// Requests are read one JSON object per line from stdin, or from each client
+// of a Unix socket if socket_path is not NULL, e.g.
+//   {"id": 1, "instance": "data/NL8.data", "seed": 3, "time_limit": 5,
+//    "settings": {"temp": 300, "replicas": 4}}
+// instance is a file, or "teams": n for data/NLn.data. The settings are
+// temp, beta, weight, delta, reheat, phase, counter, replicas, gap,
+// generator and moves, given in "settings" or alongside the other fields,
+// and any not given are taken from settings. replicas is at most
+// MAX_REPLICAS, as each takes a thread.
+// Each is answered with a single line, in the order they finish, e.g.
+//   {"id": 1, "status": "ok", "valid": true, "cost": 39721, ...,
+//    "schedule": [[-2, 1, ...], ...]}
+// where the schedule holds each round's opponent of teams 1 to n, negative
+// if away, or with "status": "error" and an "error" message.
+// Instances are loaded the first time they are asked for, and up to
+// MAX_LOADED in server.c are kept, dropping the least recently used that
+// isn't being solved for another. With cache set, each instance file asked
+// for gets a binary cache written next to it, see LoadInstance.
+// Reading stdin stops at its end once every request has been answered, a
+// socket is served until the process is killed.
+// returns false if the socket could not be opened or stopped accepting
+bool Serve(char *socket_path, unsigned threads, bool cache, Settings settings);
+
+#endif /* SERVER_H */
@@ -0,0 +1,265 @@
+#include "simd.h"
+
+// x86 only, and only for round major schedules where a round's teams are
+// next to each other
+#if (defined(__x86_64__) && defined(__GNUC__)) && !defined(TEAM_MAJOR) && \
+		!defined(NO_SIMD)
+#define SIMD_X86
+#include <immintrin.h>
+#include <string.h>
+#endif
+
+#ifdef SIMD_X86
+// Lanes past the last team are treated as a team at home against itself,
+// always valid to look up and travelling nowhere, then dropped when storing.
+// Their cells are read from the row's padding, or the spare line after the
+// last row, and ignored
+
+// AVX2, 8 teams at a time
+
+// cells t0 to t0 + 7 of round r, widened to 32 bits
+__attribute__((target("avx2")))
+static inline __m256i __LoadAVX2(Schedule *s, int r, int t0) {
+#ifdef WIDE_CELLS
+	return _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i *) &SLOT(s, r, t0)));
+#else
+	return _mm256_cvtepi8_epi32(_mm_loadl_epi64((__m128i *) &SLOT(s, r, t0)));
+#endif
+}
+
+// distances at index, from the 16 bit copy if there is one
+__attribute__((target("avx2")))
+static inline __m256i __GatherAVX2(Schedule *s, __m256i index) {
+	if (s->cost.distance16) {
+		// 32 bits from each 16 bit distance, the top half is the next one
+		__m256i dist = _mm256_i32gather_epi32((const int *) s->cost.distance16, index, 2);
+		return _mm256_and_si256(dist, _mm256_set1_epi32(0xFFFF));
+	}
+	return _mm256_i32gather_epi32(s->cost.distance, index, 4);
+}
+
+__attribute__((target("avx2")))
+static void __TourCostAVX2(Schedule *s) {
+	int n = s->num_teams;
+	__m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i nv = _mm256_set1_epi32(n);
+	__m256i offset = _mm256_set1_epi32(n + 1);
+	__m256i zero = _mm256_setzero_si256();
+	s->cost.total_cost = 0;
+	for (int t0 = 1; t0 <= n; t0 += 8) {
+		__m256i team = _mm256_add_epi32(_mm256_set1_epi32(t0), lane);
+		// lanes of real teams
+		__m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(n + 1), team);
+		team = _mm256_min_epi32(team, nv);
+		__m256i prev = team;
+		__m256i cost_lo = zero, cost_hi = zero;
+		for (int r = 0; r <= s->num_rounds; r++) {
+			__m256i loc = team;
+			if (r < s->num_rounds) {
+				__m256i opp = __LoadAVX2(s, r, t0);
+				__m256i home = _mm256_or_si256(_mm256_cmpgt_epi32(opp, zero), \
+						_mm256_xor_si256(valid, _mm256_set1_epi32(-1)));
+				loc = _mm256_blendv_epi8(_mm256_abs_epi32(opp), team, home);
+			}
+			// distance[(prev - 1) * n + (loc - 1)]
+			__m256i index = _mm256_sub_epi32(_mm256_add_epi32( \
+					_mm256_mullo_epi32(prev, nv), loc), offset);
+			__m256i dist = __GatherAVX2(s, index);
+			// widen so long tours can't overflow
+			cost_lo = _mm256_add_epi64(cost_lo, \
+					_mm256_cvtepi32_epi64(_mm256_castsi256_si128(dist)));
+			cost_hi = _mm256_add_epi64(cost_hi, \
+					_mm256_cvtepi32_epi64(_mm256_extracti128_si256(dist, 1)));
+			prev = loc;
+		}
+		unsigned long cost[8];
+		_mm256_storeu_si256((__m256i *) &cost[0], cost_lo);
+		_mm256_storeu_si256((__m256i *) &cost[4], cost_hi);
+		for (int i = 0; i < 8 && t0 + i <= n; i++) {
+			s->cost.team_cost[t0 + i] = cost[i];
+			s->cost.total_cost += cost[i];
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+static void __ViolationsAVX2(Schedule *s, int *team_nbv, int *flags) {
+	int n = s->num_teams;
+	__m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i zero = _mm256_setzero_si256();
+	__m256i one = _mm256_set1_epi32(1);
+	__m256i minus_one = _mm256_set1_epi32(-1);
+	__m256i atmost = _mm256_set1_epi32(ATMOST);
+	__m256i any_atmost = zero, any_repeat = zero;
+	for (int t0 = 1; t0 <= n; t0 += 8) {
+		__m256i team = _mm256_add_epi32(_mm256_set1_epi32(t0), lane);
+		__m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(n + 1), team);
+		// venue of the current run of games, 1 home, -1 away, 0 before the first
+		__m256i venue = zero, count = zero, last = zero, nbv = zero;
+		for (int r = 0; r < s->num_rounds; r++) {
+			__m256i opp = __LoadAVX2(s, r, t0);
+			__m256i home = _mm256_cmpgt_epi32(opp, zero);
+			__m256i away = _mm256_cmpgt_epi32(zero, opp);
+			__m256i same = _mm256_or_si256( \
+					_mm256_and_si256(_mm256_cmpeq_epi32(venue, one), home), \
+					_mm256_and_si256(_mm256_cmpeq_epi32(venue, minus_one), away));
+			// count + 1 for the same venue, else start a new run of 1
+			count = _mm256_blendv_epi8(one, _mm256_add_epi32(count, one), same);
+			venue = _mm256_blendv_epi8(minus_one, one, home);
+			__m256i too_many = _mm256_and_si256(_mm256_cmpgt_epi32(count, atmost), valid);
+			__m256i opponent = _mm256_abs_epi32(opp);
+			__m256i repeat = _mm256_and_si256(_mm256_cmpeq_epi32(last, opponent), valid);
+			last = opponent;
+			// masks are -1, so subtracting counts them
+			nbv = _mm256_sub_epi32(_mm256_sub_epi32(nbv, too_many), repeat);
+			any_atmost = _mm256_or_si256(any_atmost, too_many);
+			any_repeat = _mm256_or_si256(any_repeat, repeat);
+		}
+		_mm256_maskstore_epi32(&team_nbv[t0], valid, nbv);
+	}
+	*flags = (_mm256_testz_si256(any_atmost, any_atmost) ? 0 : SCHED_ATMOST) | \
+			(_mm256_testz_si256(any_repeat, any_repeat) ? 0 : SCHED_REPEAT);
+}
+
+// SSE4.1, 4 teams at a time, without gathers or masked loads
+
+// cells t0 to t0 + 3 of round r, widened to 32 bits
+__attribute__((target("sse4.1")))
+static inline __m128i __LoadSSE4(Schedule *s, int r, int t0) {
+#ifdef WIDE_CELLS
+	return _mm_cvtepi16_epi32(_mm_loadl_epi64((__m128i *) &SLOT(s, r, t0)));
+#else
+	int32_t cells;
+	memcpy(&cells, &SLOT(s, r, t0), sizeof(cells));
+	return _mm_cvtepi8_epi32(_mm_cvtsi32_si128(cells));
+#endif
+}
+
+__attribute__((target("sse4.1")))
+static void __TourCostSSE4(Schedule *s) {
+	int n = s->num_teams;
+	__m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+	__m128i nv = _mm_set1_epi32(n);
+	__m128i offset = _mm_set1_epi32(n + 1);
+	__m128i zero = _mm_setzero_si128();
+	s->cost.total_cost = 0;
+	for (int t0 = 1; t0 <= n; t0 += 4) {
+		__m128i team = _mm_add_epi32(_mm_set1_epi32(t0), lane);
+		__m128i valid = _mm_cmpgt_epi32(_mm_set1_epi32(n + 1), team);
+		team = _mm_min_epi32(team, nv);
+		__m128i prev = team;
+		unsigned long cost[4] = {0};
+		for (int r = 0; r <= s->num_rounds; r++) {
+			__m128i loc = team;
+			if (r < s->num_rounds) {
+				__m128i opp = __LoadSSE4(s, r, t0);
+				__m128i home = _mm_or_si128(_mm_cmpgt_epi32(opp, zero), \
+						_mm_xor_si128(valid, _mm_set1_epi32(-1)));
+				loc = _mm_blendv_epi8(_mm_abs_epi32(opp), team, home);
+			}
+			__m128i index = _mm_sub_epi32(_mm_add_epi32(_mm_mullo_epi32(prev, nv), loc), \
+					offset);
+			cost[0] += __Distance(&s->cost, _mm_extract_epi32(index, 0));
+			cost[1] += __Distance(&s->cost, _mm_extract_epi32(index, 1));
+			cost[2] += __Distance(&s->cost, _mm_extract_epi32(index, 2));
+			cost[3] += __Distance(&s->cost, _mm_extract_epi32(index, 3));
+			prev = loc;
+		}
+		for (int i = 0; i < 4 && t0 + i <= n; i++) {
+			s->cost.team_cost[t0 + i] = cost[i];
+			s->cost.total_cost += cost[i];
+		}
+	}
+}
+
+__attribute__((target("sse4.1")))
+static void __ViolationsSSE4(Schedule *s, int *team_nbv, int *flags) {
+	int n = s->num_teams;
+	__m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+	__m128i zero = _mm_setzero_si128();
+	__m128i one = _mm_set1_epi32(1);
+	__m128i minus_one = _mm_set1_epi32(-1);
+	__m128i atmost = _mm_set1_epi32(ATMOST);
+	__m128i any_atmost = zero, any_repeat = zero;
+	for (int t0 = 1; t0 <= n; t0 += 4) {
+		__m128i team = _mm_add_epi32(_mm_set1_epi32(t0), lane);
+		__m128i valid = _mm_cmpgt_epi32(_mm_set1_epi32(n + 1), team);
+		__m128i venue = zero, count = zero, last = zero, nbv = zero;
+		for (int r = 0; r < s->num_rounds; r++) {
+			__m128i opp = __LoadSSE4(s, r, t0);
+			__m128i home = _mm_cmpgt_epi32(opp, zero);
+			__m128i away = _mm_cmpgt_epi32(zero, opp);
+			__m128i same = _mm_or_si128( \
+					_mm_and_si128(_mm_cmpeq_epi32(venue, one), home), \
+					_mm_and_si128(_mm_cmpeq_epi32(venue, minus_one), away));
+			count = _mm_blendv_epi8(one, _mm_add_epi32(count, one), same);
+			venue = _mm_blendv_epi8(minus_one, one, home);
+			__m128i too_many = _mm_and_si128(_mm_cmpgt_epi32(count, atmost), valid);
+			__m128i opponent = _mm_abs_epi32(opp);
+			__m128i repeat = _mm_and_si128(_mm_cmpeq_epi32(last, opponent), valid);
+			last = opponent;
+			nbv = _mm_sub_epi32(_mm_sub_epi32(nbv, too_many), repeat);
+			any_atmost = _mm_or_si128(any_atmost, too_many);
+			any_repeat = _mm_or_si128(any_repeat, repeat);
+		}
+		int val[4];
+		_mm_storeu_si128((__m128i *) val, nbv);
+		for (int i = 0; i < 4 && t0 + i <= n; i++) {
+			team_nbv[t0 + i] = val[i];
+		}
+	}
+	*flags = (_mm_testz_si128(any_atmost, any_atmost) ? 0 : SCHED_ATMOST) | \
+			(_mm_testz_si128(any_repeat, any_repeat) ? 0 : SCHED_REPEAT);
+}
+#endif
+
+int SimdLevel(void) {
+#ifdef SIMD_X86
+	if (__builtin_cpu_supports("avx2")) {
+		return SIMD_AVX2;
+	} else if (__builtin_cpu_supports("sse4.1")) {
+		return SIMD_SSE4;
+	}
+#endif
+	return SIMD_NONE;
+}
+
+bool SimdTourCostAt(Schedule *s, int level) {
+	if (level > SimdLevel()) {
+		return false;
+	}
+#ifdef SIMD_X86
+	if (level == SIMD_AVX2) {
+		__TourCostAVX2(s);
+		return true;
+	} else if (level == SIMD_SSE4) {
+		__TourCostSSE4(s);
+		return true;
+	}
+#endif
+	return false;
+}
+
+bool SimdViolationsAt(Schedule *s, int level, int *team_nbv, int *flags) {
+	if (level > SimdLevel()) {
+		return false;
+	}
+#ifdef SIMD_X86
+	if (level == SIMD_AVX2) {
+		__ViolationsAVX2(s, team_nbv, flags);
+		return true;
+	} else if (level == SIMD_SSE4) {
+		__ViolationsSSE4(s, team_nbv, flags);
+		return true;
+	}
+#endif
+	return false;
+}
+
+bool SimdTourCost(Schedule *s) {
+	return SimdTourCostAt(s, SimdLevel());
+}
+
+bool SimdViolations(Schedule *s, int *team_nbv, int *flags) {
+	return SimdViolationsAt(s, SimdLevel(), team_nbv, flags);
+}
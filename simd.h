@@ -0,0 +1,30 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "ttp.h"
+
+// Vector versions of the full schedule scans, taking every team of a round at
+// once. The best the CPU supports, AVX2 then SSE4.1, is picked at runtime.
+// Each returns false without doing anything if there are none, or when built
+// with TEAM_MAJOR or NO_SIMD, leaving the caller to run the scalar scan that
+// they are checked against
+
+// instruction sets the scans can use, each needing the ones before it
+enum {SIMD_NONE, SIMD_SSE4, SIMD_AVX2};
+static const char *const SIMD_NAMES[] = {"scalar", "SSE4.1", "AVX2"};
+
+// the best instruction set the scans can use in this build on this CPU
+int SimdLevel(void);
+
+// Compute every team's travel distance and the total
+bool SimdTourCost(Schedule *s);
+// Count each team's soft constraint violations into team_nbv, and set
+// SCHED_ATMOST and SCHED_REPEAT in flags for the constraints that fail
+bool SimdViolations(Schedule *s, int *team_nbv, int *flags);
+
+// The same with instruction set level instead of the best, so each can be
+// checked, returning false for SIMD_NONE or above SimdLevel()
+bool SimdTourCostAt(Schedule *s, int level);
+bool SimdViolationsAt(Schedule *s, int level, int *team_nbv, int *flags);
+
+#endif /* SIMD_H */
@@ -0,0 +1,357 @@
+#include "sweep.h"
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+
+#define MAX_VALUES	64
+#define MAX_LINE	4096
+
+// Values to try for a single setting
+typedef struct {
+	double val[MAX_VALUES];
+	int num;
+} Axis;
+
+enum {AXIS_TEMP, AXIS_BETA, AXIS_WEIGHT, AXIS_DELTA, AXIS_REHEAT, AXIS_PHASE, \
+		AXIS_COUNTER, AXIS_SEEDS, NUM_AXES};
+
+static const char *const AXIS_NAMES[] = {
+		"temp", "beta", "weight", "delta", \
+		"reheat", "phase", "counter", "seeds", 0
+};
+
+// A single combination of settings, run once per seed
+typedef struct {
+	Settings settings;
+	int remaining;
+} Config;
+
+// A single run of a config for one seed
+typedef struct {
+	int config;
+	unsigned seed;
+	int invalid;
+	unsigned long cost;
+	long wall;
+	long cpu;
+} Job;
+
+// Jobs waiting to run on one worker, other workers steal from the head
+// when they run out
+typedef struct {
+	pthread_mutex_t lock;
+	int *job;
+	int head;
+	int tail;
+} Queue;
+
+typedef struct {
+	TtpContext *ctx;
+	Config *config;
+	int num_configs;
+	Job *job;
+	int num_jobs;
+	int num_seeds;
+	Queue *queue;
+	unsigned num_queues;
+	pthread_mutex_t lock;
+	FILE *results;
+	int done;
+	bool update;
+} Pool;
+
+typedef struct {
+	Pool *pool;
+	unsigned index;
+} Worker;
+
+static long __Nanoseconds(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (ts.tv_sec * 1000000000L) + ts.tv_nsec;
+}
+
+// check a value for a setting is in range, same limits as the command line
+static bool CheckValue(int axis, double val) {
+	switch (axis) {
+		case AXIS_TEMP:
+		case AXIS_WEIGHT:
+			return val > 0;
+		case AXIS_BETA:
+			return val > 0 && val < 1;
+		case AXIS_DELTA:
+			return val > 1;
+		case AXIS_SEEDS:
+			return val >= 0 && val <= UINT_MAX && val == (unsigned) val;
+		default:
+			return val > 0 && val <= UINT_MAX && val == (unsigned) val;
+	}
+}
+
+// read the grid spec, filling in settings that are not given from settings
+static bool ReadSpec(char *spec, Axis *axes, Settings settings) {
+	FILE *fptr = fopen(spec, "r");
+	if (fptr == NULL) {
+		printf("Unable to read file %s\n", spec);
+		return false;
+	}
+	for (int i = 0; i < NUM_AXES; i++) {
+		axes[i].num = 0;
+	}
+	char line[MAX_LINE];
+	int line_num = 0;
+	while (fgets(line, sizeof(line), fptr)) {
+		line_num++;
+		char *tok = strtok(line, " \t\r\n");
+		if (tok == NULL || tok[0] == '#') {
+			continue;
+		}
+		int axis;
+		for (axis = 0; AXIS_NAMES[axis]; axis++) {
+			if (!strcmp(tok, AXIS_NAMES[axis])) {
+				break;
+			}
+		}
+		if (!AXIS_NAMES[axis]) {
+			printf("Error: %s:%d: unknown setting %s\n", spec, line_num, tok);
+			fclose(fptr);
+			return false;
+		}
+		while ((tok = strtok(NULL, " \t\r\n"))) {
+			char *ptr;
+			double val = strtod(tok, &ptr);
+			if (ptr == tok || *ptr || !CheckValue(axis, val)) {
+				printf("Error: %s:%d: invalid value %s for %s\n", spec, line_num, \
+						tok, AXIS_NAMES[axis]);
+				fclose(fptr);
+				return false;
+			}
+			if (axes[axis].num == MAX_VALUES) {
+				printf("Error: %s:%d: more than %d values for %s\n", spec, line_num, \
+						MAX_VALUES, AXIS_NAMES[axis]);
+				fclose(fptr);
+				return false;
+			}
+			axes[axis].val[axes[axis].num++] = val;
+		}
+	}
+	fclose(fptr);
+
+	// defaults for anything not given
+	double defaults[NUM_AXES] = {
+			settings.temp, settings.beta, settings.weight, settings.delta, \
+			settings.max_reheat, settings.max_phase, settings.max_counter, 0
+	};
+	for (int i = 0; i < NUM_AXES; i++) {
+		if (axes[i].num == 0) {
+			axes[i].val[axes[i].num++] = defaults[i];
+		}
+	}
+	return true;
+}
+
+// build the settings for config c, the last axis changing fastest
+static Settings ConfigSettings(Axis *axes, int c, Settings settings) {
+	int index[NUM_AXES];
+	for (int i = AXIS_SEEDS - 1; i >= 0; i--) {
+		index[i] = c % axes[i].num;
+		c /= axes[i].num;
+	}
+	settings.temp = axes[AXIS_TEMP].val[index[AXIS_TEMP]];
+	settings.beta = axes[AXIS_BETA].val[index[AXIS_BETA]];
+	settings.weight = axes[AXIS_WEIGHT].val[index[AXIS_WEIGHT]];
+	settings.delta = settings.theta = axes[AXIS_DELTA].val[index[AXIS_DELTA]];
+	settings.max_reheat = axes[AXIS_REHEAT].val[index[AXIS_REHEAT]];
+	settings.max_phase = axes[AXIS_PHASE].val[index[AXIS_PHASE]];
+	settings.max_counter = axes[AXIS_COUNTER].val[index[AXIS_COUNTER]];
+	settings.update = false;
+	settings.checkpoint = NULL;
+	settings.time_limit = 0;
+	settings.progress = NULL;
+	settings.trace = NULL;
+	return settings;
+}
+
+// write the results of every seed of config c
+// times are in nanoseconds over all runs, costs over the valid runs
+static void WriteConfig(Pool *pool, int c) {
+	Settings *settings = &pool->config[c].settings;
+	Job *job = &pool->job[c * pool->num_seeds];
+	int successful = 0;
+	unsigned min_seed = 0, max_seed = 0;
+	unsigned long min_cost = 0, max_cost = 0, avg_cost = 0;
+	long min_wall = job[0].wall, max_wall = 0, avg_wall = 0;
+	long min_cpu = job[0].cpu, max_cpu = 0, avg_cpu = 0;
+	for (int i = 0; i < pool->num_seeds; i++) {
+		min_wall = (job[i].wall < min_wall) ? job[i].wall : min_wall;
+		max_wall = (job[i].wall > max_wall) ? job[i].wall : max_wall;
+		avg_wall += job[i].wall;
+		min_cpu = (job[i].cpu < min_cpu) ? job[i].cpu : min_cpu;
+		max_cpu = (job[i].cpu > max_cpu) ? job[i].cpu : max_cpu;
+		avg_cpu += job[i].cpu;
+		if (job[i].invalid) {
+			continue;
+		}
+		if (!successful || job[i].cost < min_cost) {
+			min_cost = job[i].cost;
+			min_seed = job[i].seed;
+		}
+		if (!successful || job[i].cost > max_cost) {
+			max_cost = job[i].cost;
+			max_seed = job[i].seed;
+		}
+		avg_cost += job[i].cost;
+		successful++;
+	}
+	if (successful) {
+		avg_cost /= successful;
+	}
+	fprintf(pool->results, "%f,%f,%f,%f,%u,%u,%u,%d,%u,%u,%lu,%lu,%lu," \
+			"%ld,%ld,%ld,%ld,%ld,%ld\n", settings->temp, settings->beta, \
+			settings->weight, settings->delta, settings->max_reheat, \
+			settings->max_phase, settings->max_counter, successful, min_seed, \
+			max_seed, min_cost, max_cost, avg_cost, min_wall, max_wall, \
+			avg_wall / pool->num_seeds, min_cpu, max_cpu, avg_cpu / pool->num_seeds);
+	fflush(pool->results);
+}
+
+// run a single job on its own context
+static void RunJob(Pool *pool, Job *job) {
+	TtpContext *ctx = TtpClone(pool->ctx);
+	long wall = __Nanoseconds(CLOCK_MONOTONIC);
+	long cpu = __Nanoseconds(CLOCK_THREAD_CPUTIME_ID);
+	job->invalid = TtpSolve(ctx, job->seed, &pool->config[job->config].settings, NULL, NULL);
+	job->cpu = __Nanoseconds(CLOCK_THREAD_CPUTIME_ID) - cpu;
+	job->wall = __Nanoseconds(CLOCK_MONOTONIC) - wall;
+	job->cost = TtpCost(ctx);
+	TtpDelete(ctx);
+
+	pthread_mutex_lock(&pool->lock);
+	if (--pool->config[job->config].remaining == 0) {
+		WriteConfig(pool, job->config);
+	}
+	pool->done++;
+	if (pool->update) {
+		printf("\rPercentage complete: %f", ((double) pool->done / pool->num_jobs) * 100);
+		fflush(stdout);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+// take the newest job from queue q, or the oldest if stealing
+// returns -1 if the queue is empty
+static int TakeJob(Queue *q, bool steal) {
+	int job = -1;
+	pthread_mutex_lock(&q->lock);
+	if (q->head < q->tail) {
+		job = (steal) ? q->job[q->head++] : q->job[--q->tail];
+	}
+	pthread_mutex_unlock(&q->lock);
+	return job;
+}
+
+static void *DoWork(void *arg) {
+	Worker *w = arg;
+	Pool *pool = w->pool;
+	while (true) {
+		int job = TakeJob(&pool->queue[w->index], false);
+		// out of work, steal from the others
+		for (unsigned i = 1; job < 0 && i < pool->num_queues; i++) {
+			job = TakeJob(&pool->queue[(w->index + i) % pool->num_queues], true);
+		}
+		if (job < 0) {
+			break;
+		}
+		RunJob(pool, &pool->job[job]);
+	}
+	return NULL;
+}
+
+bool Sweep(TtpContext *ctx, char *spec, char *results, unsigned threads, \
+		Settings settings) {
+	Axis axes[NUM_AXES];
+	if (!ReadSpec(spec, axes, settings)) {
+		return false;
+	}
+
+	Pool pool;
+	pool.ctx = ctx;
+	pool.num_configs = 1;
+	for (int i = 0; i < AXIS_SEEDS; i++) {
+		pool.num_configs *= axes[i].num;
+	}
+	pool.num_seeds = axes[AXIS_SEEDS].num;
+	pool.num_jobs = pool.num_configs * pool.num_seeds;
+	pool.done = 0;
+	pool.update = settings.update;
+	pool.results = fopen(results, "w");
+	if (pool.results == NULL) {
+		printf("Unable to write file %s\n", results);
+		return false;
+	}
+	fprintf(pool.results, "Temp,Beta,Weight,Delta,Reheat,Phase,Counter,Successful," \
+			"Min-Seed,Max-Seed,Min-Cost,Max-Cost,Avg-Cost," \
+			"Min-Wall,Max-Wall,Avg-Wall,Min-CPU,Max-CPU,Avg-CPU\n");
+	fflush(pool.results);
+
+	pool.config = calloc(pool.num_configs, sizeof(*(pool.config)));
+	for (int i = 0; i < pool.num_configs; i++) {
+		pool.config[i].settings = ConfigSettings(axes, i, settings);
+		pool.config[i].remaining = pool.num_seeds;
+	}
+	pool.job = calloc(pool.num_jobs, sizeof(*(pool.job)));
+	for (int i = 0; i < pool.num_jobs; i++) {
+		pool.job[i].config = i / pool.num_seeds;
+		pool.job[i].seed = axes[AXIS_SEEDS].val[i % pool.num_seeds];
+	}
+
+	// deal the jobs out to the workers, in order so each starts on its own config
+	pool.num_queues = threads;
+	pool.queue = calloc(threads, sizeof(*(pool.queue)));
+	for (unsigned i = 0; i < threads; i++) {
+		pthread_mutex_init(&pool.queue[i].lock, NULL);
+		pool.queue[i].job = calloc(pool.num_jobs / threads + 1, sizeof(*(pool.queue[i].job)));
+	}
+	for (int i = pool.num_jobs - 1; i >= 0; i--) {
+		Queue *q = &pool.queue[i % threads];
+		q->job[q->tail++] = i;
+	}
+	pthread_mutex_init(&pool.lock, NULL);
+
+	Worker *workers = calloc(threads, sizeof(*workers));
+	pthread_t *tids = calloc(threads, sizeof(*tids));
+	unsigned started = 0;
+	for (unsigned i = 0; i < threads; i++) {
+		workers[i].pool = &pool;
+		workers[i].index = i;
+	}
+	while (started < threads && !pthread_create(&tids[started], NULL, DoWork, \
+			&workers[started])) {
+		started++;
+	}
+	// the workers that did start steal the queues of those that didn't,
+	// and if none did this thread works through them
+	if (!started) {
+		DoWork(&workers[0]);
+	}
+	for (unsigned i = 0; i < started; i++) {
+		pthread_join(tids[i], NULL);
+	}
+	if (pool.update) {
+		printf("\nDone.\n");
+	}
+
+	free(tids);
+	free(workers);
+	pthread_mutex_destroy(&pool.lock);
+	for (unsigned i = 0; i < threads; i++) {
+		pthread_mutex_destroy(&pool.queue[i].lock);
+		free(pool.queue[i].job);
+	}
+	free(pool.queue);
+	free(pool.job);
+	free(pool.config);
+	fclose(pool.results);
+	return true;
+}
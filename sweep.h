@@ -0,0 +1,20 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "ttp.h"
+
+// Parameter sweep over a grid of settings
+// The grid spec is a text file with one setting per line, followed by the
+// values to try, e.g. "temp 300 350 400". Settings are temp, beta, weight,
+// delta, reheat, phase, counter and seeds. Any setting not given uses the
+// value from settings. Lines starting with # are ignored.
+// Every combination is run once per seed, on a pool of threads, each on a
+// clone of ctx. One line per combination is written to results as it
+// finishes.
+// Each run anneals on the one thread it is timed on, settings.replicas must
+// be 0 as tempering would run chains on threads of their own.
+// returns false on failure
+bool Sweep(TtpContext *ctx, char *spec, char *results, unsigned threads, \
+		Settings settings);
+
+#endif /* SWEEP_H */
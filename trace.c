@@ -0,0 +1,85 @@
+#include "trace.h"
+#include <string.h>
+#include <float.h>
+#include <time.h>
+
+// how long the writer sleeps when there is nothing to write
+#define TRACE_SLEEP_NS		10000000
+
+static void __WriteSample(Trace *t, TraceSample *s) {
+	if (!t->csv) {
+		fwrite(s, sizeof(*s), 1, t->f);
+		return;
+	}
+	fprintf(t->f, "%.6f,%lu,%f,%f,%f,%d,", s->seconds, (unsigned long) s->iteration, \
+			s->temp, s->weight, s->cost, s->nbv);
+	if (s->best_feasible < DBL_MAX) {
+		fprintf(t->f, "%f", s->best_feasible);
+	}
+	fputc(',', t->f);
+	if (s->best_infeasible < DBL_MAX) {
+		fprintf(t->f, "%f", s->best_infeasible);
+	}
+	fputc('\n', t->f);
+}
+
+// drain the buffer to the file until told to stop
+static void *__TraceWriter(void *arg) {
+	Trace *t = arg;
+	struct timespec nap = {0, TRACE_SLEEP_NS};
+	while (true) {
+		// read before head, so everything recorded before stopping is written
+		bool stop = __atomic_load_n(&t->stop, __ATOMIC_ACQUIRE);
+		uint64_t head = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);
+		uint64_t tail = t->tail;
+		for (; tail < head; tail++) {
+			__WriteSample(t, &t->sample[tail & (TRACE_CAPACITY - 1)]);
+		}
+		__atomic_store_n(&t->tail, tail, __ATOMIC_RELEASE);
+		if (stop) {
+			break;
+		}
+		nanosleep(&nap, NULL);
+	}
+	return NULL;
+}
+
+Trace *TraceOpen(char *filename) {
+	FILE *f = fopen(filename, "wb");
+	if (f == NULL) {
+		return NULL;
+	}
+	Trace *t;
+	if (posix_memalign((void **) &t, CACHE_LINE, sizeof(*t))) {
+		fclose(f);
+		return NULL;
+	}
+	memset(t, 0, sizeof(*t));
+	t->sample = calloc(TRACE_CAPACITY, sizeof(*(t->sample)));
+	t->f = f;
+	size_t len = strlen(filename);
+	t->csv = len >= 4 && !strcmp(filename + len - 4, ".csv");
+	if (t->csv) {
+		fprintf(f, "seconds,iteration,temp,weight,cost,nbv,best_feasible,best_infeasible\n");
+	} else {
+		TraceHeader h = {TRACE_MAGIC, TRACE_VERSION, sizeof(TraceSample), 0};
+		fwrite(&h, sizeof(h), 1, f);
+	}
+	if (pthread_create(&t->writer, NULL, __TraceWriter, t)) {
+		fclose(f);
+		free(t->sample);
+		free(t);
+		return NULL;
+	}
+	return t;
+}
+
+unsigned long TraceClose(Trace *t) {
+	__atomic_store_n(&t->stop, true, __ATOMIC_RELEASE);
+	pthread_join(t->writer, NULL);
+	fclose(t->f);
+	unsigned long dropped = t->dropped;
+	free(t->sample);
+	free(t);
+	return dropped;
+}
@@ -0,0 +1,82 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "ttp.h"
+#include <pthread.h>
+
+// Convergence trace of a run, samples of where annealing is taken every
+// Settings.trace_every moves
+// Samples go into a ring buffer that the annealing thread only ever writes,
+// and a background thread drains to the file, so recording one is a copy
+// and never waits. If the writer falls a whole buffer behind samples are
+// dropped rather than slowing the run.
+// Files ending in .csv are written as CSV, with a header line and the best
+// costs left empty until there is one. Any other file is binary, a
+// TraceHeader followed by the TraceSamples as they are in memory.
+
+// samples the ring buffer holds, a power of two
+#define TRACE_CAPACITY		65536
+
+// A single sample
+typedef struct {
+	// since the run started
+	double seconds;
+	// moves made so far
+	uint64_t iteration;
+	double temp;
+	double weight;
+	// objective of the current schedule
+	double cost;
+	int32_t nbv;
+	int32_t pad;
+	// DBL_MAX until there is one
+	double best_feasible;
+	double best_infeasible;
+} TraceSample;
+
+#define TRACE_MAGIC		0x54505454	/* "TTPT" */
+#define TRACE_VERSION	1
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	// sizeof(TraceSample)
+	uint32_t sample_size;
+	uint32_t pad;
+} TraceHeader;
+
+struct Trace {
+	TraceSample *sample;
+	// next sample to record, only moved by the annealing thread
+	uint64_t head __attribute__((aligned(CACHE_LINE)));
+	// samples dropped as the buffer was full
+	unsigned long dropped;
+	// next sample to write, only moved by the writer, a line of its own so
+	// the two threads don't contend for it
+	uint64_t tail __attribute__((aligned(CACHE_LINE)));
+	bool stop;
+	bool csv;
+	FILE *f;
+	pthread_t writer;
+};
+
+// Start tracing to filename, returns NULL if it can't be written or the
+// writer thread can't be started
+Trace *TraceOpen(char *filename);
+// Write out every sample recorded and stop tracing
+// returns the number of samples dropped
+unsigned long TraceClose(Trace *t);
+
+// record a sample, dropping it if the buffer is full
+// only one thread may record to a trace
+static inline void TraceRecord(Trace *t, const TraceSample *sample) {
+	uint64_t head = t->head;
+	if (head - __atomic_load_n(&t->tail, __ATOMIC_ACQUIRE) == TRACE_CAPACITY) {
+		t->dropped++;
+		return;
+	}
+	t->sample[head & (TRACE_CAPACITY - 1)] = *sample;
+	__atomic_store_n(&t->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* TRACE_H */
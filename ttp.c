@@ -1,7 +1,14 @@
 #include "ttp.h"
+#include "instance.h"
+#include "simd.h"
+#include "bound.h"
+#include "core.h"
 #include <string.h>
 #include <math.h>
 #include <float.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 
 // check if the schedule is empty
 static bool ScheduleEmpty(Schedule *s) {
@@ -20,7 +27,7 @@ static int SetChoices(int *order, Schedule *s, int t) {
 		if (i != t) {
 			order[n++] = i;
 			for (int k = 0; k < s->num_rounds; k++) {
-				if (s->round[k]->team[t] == i) {
+				if (SLOT(s, k, t) == i) {
 					order[--n] = 0;
 					break;
 				}
@@ -32,7 +39,7 @@ static int SetChoices(int *order, Schedule *s, int t) {
 		if (i != t) {
 			order[n++] = -i;
 			for (int k = 0; k < s->num_rounds; k++) {
-				if (s->round[k]->team[t] == -i) {
+				if (SLOT(s, k, t) == -i) {
 					order[--n] = 0;
 					break;
 				}
@@ -43,18 +50,34 @@ static int SetChoices(int *order, Schedule *s, int t) {
 	return n;
 }
 
+// seed a random number generator, each seed gives its own sequence
+void SeedRng(Rng *rng, unsigned seed) {
+	rng->state = 0;
+	rng->inc = ((uint64_t) seed << 1) | 1;
+	__NextRand(rng);
+	rng->state += 0x853c49e6748fea9bULL ^ seed;
+	__NextRand(rng);
+}
+
+// seed the schedule's random number generator
+// each seed gives its own sequence, independent of any other schedule
+void SeedSchedule(Schedule *s, unsigned seed) {
+	SeedRng(&s->rng, seed);
+}
+
 // randomize the order for num_rounds for team t
-static void RandomizeOrder(int *order, int num_choices) {
+static void RandomizeOrder(Schedule *s, int *order, int num_choices) {
 	for (int i = 0; i < num_choices; i++) {
-		unsigned index = rand() % num_choices;
+		unsigned index = __RandRange(s, num_choices);
 		int tmp = order[index];
 		order[index] = order[i];
 		order[i] = tmp;
 	}
 }
 
-// generate a random schedule
-bool GenerateSchedule(Schedule *s) {
+// generate a random schedule, order holds the choices for every level
+// of recursion, num_rounds at a time
+static bool __GenerateSchedule(Schedule *s, int *order) {
 	bool retval = false;
 	if (ScheduleEmpty(s)) {
 		return true;
@@ -63,7 +86,7 @@ bool GenerateSchedule(Schedule *s) {
 	// find the smallest team for the smallest week
 	for (w = 0; w < s->num_rounds; w++) {
 		for (t = 1; t <= s->num_teams; t++) {
-			if (s->round[w]->team[t] == 0) {
+			if (SLOT(s, w, t) == 0) {
 				break;
 			}
 		}
@@ -71,74 +94,221 @@ bool GenerateSchedule(Schedule *s) {
 			break;
 		}
 	}
-	int *order = calloc(s->num_rounds, sizeof(*order));
+	memset(order, 0, s->num_rounds * sizeof(*order));
 	int num_choices = SetChoices(order, s, t);
-	RandomizeOrder(order, num_choices);
+	RandomizeOrder(s, order, num_choices);
 	for (int i = 0; i < s->num_rounds; i++) {
 		int choice = order[i];
-		if (choice != 0 && s->round[w]->team[abs(choice)] == 0) {
-			s->round[w]->team[t] = choice;
-			s->round[w]->team[abs(choice)] = (choice > 0) ? -t : t;
+		if (choice != 0 && SLOT(s, w, abs(choice)) == 0) {
+			SLOT(s, w, t) = choice;
+			SLOT(s, w, abs(choice)) = (choice > 0) ? -t : t;
 			s->set_vals += 2;
-			if (GenerateSchedule(s)) {
+			if (__GenerateSchedule(s, order + s->num_rounds)) {
 				retval = true;
 				break;
 			} else {
 				s->set_vals -= 2;
-				s->round[w]->team[t] = 0;
-				s->round[w]->team[abs(choice)] = 0;
+				SLOT(s, w, t) = 0;
+				SLOT(s, w, abs(choice)) = 0;
 			}
 		}
 	}
+	return retval;
+}
+
+// generate a random schedule
+bool GenerateSchedule(Schedule *s) {
+	// each level of recursion sets one game
+	int depth = (s->num_rounds * s->num_teams) / 2;
+	int *order = calloc(depth * s->num_rounds, sizeof(*order));
+	bool retval = __GenerateSchedule(s, order);
 	free(order);
-	//printf("Returning\n");
 	return retval;
 }
 
-// Create a new schedule for N teams with random matchups
-Schedule *CreateSchedule(int num_teams) {
+// generate a random schedule with the circle method, in O(teams * rounds)
+// Teams are randomly relabeled and placed around a circle that is rotated
+// once per round. Each game's home team is flipped at random, the rounds of
+// the first half are shuffled, and the second half plays the same games
+// with home and away swapped in another random order
+// requires an empty schedule, always succeeds for an even number of teams
+bool CircleSchedule(Schedule *s) {
+	int n = s->num_teams;
+	int half = n - 1;
+	int *label = __ScratchGet(s, n + 1);
+	int *order = __ScratchGet(s, half);
+	// random relabeling of the teams
+	for (int i = 0; i < n; i++) {
+		label[i] = i + 1;
+	}
+	for (int i = n - 1; i > 0; i--) {
+		int j = __RandRange(s, i + 1);
+		int tmp = label[i];
+		label[i] = label[j];
+		label[j] = tmp;
+	}
+	// random order for the rounds of the first half
+	for (int i = 0; i < half; i++) {
+		order[i] = i;
+	}
+	for (int i = half - 1; i > 0; i--) {
+		int j = __RandRange(s, i + 1);
+		int tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+	for (int r = 0; r < half; r++) {
+		int w = order[r];
+		for (int k = 0; k < n / 2; k++) {
+			// position n - 1 stays fixed while the others rotate
+			int a = (k == 0) ? n - 1 : (r + k) % half;
+			int b = (r + half - k) % half;
+			int home = label[a], away = label[b];
+			if (__RandRange(s, 2)) {
+				home = label[b];
+				away = label[a];
+			}
+			SLOT(s, w, home) = away;
+			SLOT(s, w, away) = -home;
+		}
+	}
+	// random order for the second half, with the first game of the second
+	// half not repeating the last game of the first
+	for (int i = half - 1; i > 0; i--) {
+		int j = __RandRange(s, i + 1);
+		int tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+	if (half > 1 && order[0] == half - 1) {
+		int j = __RandRange(s, half - 1) + 1;
+		order[0] = order[j];
+		order[j] = half - 1;
+	}
+	for (int r = 0; r < half; r++) {
+		for (int t = 1; t <= n; t++) {
+			SLOT(s, half + r, t) = -SLOT(s, order[r], t);
+		}
+	}
+	s->set_vals = s->num_rounds * s->num_teams;
+	__ScratchPut(s, n + 1 + half);
+	return true;
+}
+
+// generate a starting schedule for s with generator
+bool StartSchedule(Schedule *s, int generator) {
+	if (generator == GEN_AUTO) {
+		generator = (s->num_teams > BACKTRACK_MAX_TEAMS) ? GEN_CIRCLE : GEN_BACKTRACK;
+	}
+	if (generator == GEN_CIRCLE) {
+		return CircleSchedule(s);
+	}
+	return GenerateSchedule(s);
+}
+
+// make the 16 bit copy of s's distances if they all fit
+static void CompactDistance(Schedule *s) {
+	int n = s->num_teams * s->num_teams;
+	if (!s->cost.shared16) {
+		free(s->cost.distance16);
+	}
+	s->cost.distance16 = NULL;
+	s->cost.shared16 = false;
+	for (int i = 0; i < n; i++) {
+		if (s->cost.distance[i] < 0 || s->cost.distance[i] > UINT16_MAX) {
+			return;
+		}
+	}
+	// one spare, the vector kernels read 32 bits at a time
+	s->cost.distance16 = calloc(n + 1, sizeof(*(s->cost.distance16)));
+	for (int i = 0; i < n; i++) {
+		s->cost.distance16[i] = s->cost.distance[i];
+	}
+}
+
+// Create a new schedule for N teams, using distance if it is not NULL, and
+// its 16 bit copy distance16 if that is not NULL too
+static Schedule *__CreateSchedule(int num_teams, int *distance, uint16_t *distance16) {
 	Schedule *s = calloc(1, sizeof(*s));
 	s->num_teams = num_teams;
 	s->num_rounds = (num_teams * 2) - 2;
-	s->round = calloc(s->num_rounds, sizeof(*(s->round)));
-	s->cost.distance = calloc(s->num_teams * s->num_teams, sizeof(*(s->cost.distance)));
+	if (distance) {
+		s->cost.distance = distance;
+		s->cost.shared = true;
+		if (distance16) {
+			s->cost.distance16 = distance16;
+			s->cost.shared16 = true;
+		} else {
+			CompactDistance(s);
+		}
+	} else {
+		s->cost.distance = calloc(s->num_teams * s->num_teams, sizeof(*(s->cost.distance)));
+		s->cost.shared = false;
+	}
 	s->cost.team_cost = calloc(s->num_teams + 1, sizeof(*(s->cost.team_cost)));
-	s->cost.updated = calloc(s->num_teams + 1, sizeof(*(s->cost.updated)));
+	s->cost.dirty = calloc((s->num_teams / 64) + 1, sizeof(*(s->cost.dirty)));
+	s->cost.delta = calloc(s->num_teams + 1, sizeof(*(s->cost.delta)));
 	s->cost.total_cost = 0;
+	s->viol.team_nbv = calloc(s->num_teams + 1, sizeof(*(s->viol.team_nbv)));
+	s->viol.delta = calloc(s->num_teams + 1, sizeof(*(s->viol.delta)));
+	s->viol.nbv = 0;
+	s->journal.max_changes = 4 * s->num_teams * s->num_rounds;
+	s->journal.change = calloc(s->journal.max_changes, sizeof(*(s->journal.change)));
+	s->journal.num_changes = 0;
+	// enough for the largest user, CheckSoftReq
+	s->scratch.size = 3 * (s->num_teams + 1);
+	s->scratch.mem = calloc(s->scratch.size, sizeof(*(s->scratch.mem)));
+	s->scratch.used = 0;
 
-	// allocate memory
+	// allocate memory, one cache aligned block with each row padded to a cache line
+	int row = ROW_LEN(s);
+	int num_rows = NUM_ROWS(s);
+	s->stride = (row + CACHE_LINE_CELLS - 1) & ~(CACHE_LINE_CELLS - 1);
+	// and a spare cache line, the vector kernels read a little past a row
+	size_t size = ((num_rows * s->stride) + CACHE_LINE_CELLS) * sizeof(*(s->slot));
+	if (posix_memalign((void **) &s->slot, CACHE_LINE, size)) {
+		s->slot = NULL;
+	} else {
+		memset(s->slot, 0, size);
+	}
+	s->round = calloc(s->num_rounds, sizeof(*(s->round)));
 	for (int i = 0; i < s->num_rounds; i++) {
-		s->round[i] = calloc(1, sizeof(*(s->round[i])));
-		s->round[i]->team = calloc(s->num_teams + 1, sizeof(*(s->round[i]->team)));
+		s->round[i] = i;
 	}
 
+	SeedSchedule(s, 1);
+
 	return s;
 }
 
-// copies a schedule from source to destination
-// requires both be initialized
-// if copy_costs is true, copy the cost table, else skip
-static void CopySchedule(Schedule *dst, Schedule *src, bool copy_costs) {
-	for (int i = 0; i < src->num_rounds; i++) {
-		for (int j = 1; j <= src->num_teams; j++) {
-			dst->round[i]->team[j] = src->round[i]->team[j];
-		}
-	}
-	for (int i = 1; i <= src->num_teams; i++) {
-		dst->cost.team_cost[i] = src->cost.team_cost[i];
-	}
-	dst->cost.total_cost = src->cost.total_cost;
-	if (copy_costs) {
-		for (int i = 0; i < src->num_teams * src->num_teams; i++) {
-			dst->cost.distance[i] = src->cost.distance[i];
-		}
-	}
+// Create a new empty schedule for N teams
+Schedule *CreateSchedule(int num_teams) {
+	return __CreateSchedule(num_teams, NULL, NULL);
+}
+
+// Create a new empty schedule for N teams using the given distances
+// The distances are shared, and must not be freed before the schedule
+Schedule *CreateScheduleShared(int num_teams, int *distance) {
+	Schedule *s = __CreateSchedule(num_teams, distance, NULL);
+	s->cost.lower_bound = LowerBound(s);
+	return s;
+}
+
+// Create a new empty schedule for the same teams as s
+// The distances are shared with s, which must not be deleted first
+Schedule *CloneSchedule(Schedule *s) {
+	Schedule *c = __CreateSchedule(s->num_teams, s->cost.distance, s->cost.distance16);
+	c->cost.lower_bound = s->cost.lower_bound;
+	return c;
 }
 
-// update the costs for all teams with their updated flags set to true
+// update the costs for all teams with their dirty bits set
 static void UpdateCost(Schedule *s) {
-	for (int i = 1; i <= s->num_teams; i++) {
-		if (s->cost.updated[i]) {
+	STAT_START(start);
+	for (int w = 0; w <= s->num_teams / 64; w++) {
+		while (s->cost.dirty[w]) {
+			int i = (w * 64) + __builtin_ctzll(s->cost.dirty[w]);
+			s->cost.dirty[w] &= s->cost.dirty[w] - 1;
 			s->cost.total_cost -= s->cost.team_cost[i];
 			s->cost.team_cost[i] = 0;
 
@@ -146,57 +316,102 @@ static void UpdateCost(Schedule *s) {
 			// actual cost update
 			prev_loc = i;
 			for (int j = 0; j < s->num_rounds; j++) {
-				new_loc = (s->round[j]->team[i] > 0) ? i : abs(s->round[j]->team[i]);;
+				new_loc = (SLOT(s, j, i) > 0) ? i : abs(SLOT(s, j, i));;
 				int dist = ((prev_loc - 1) * s->num_teams) + (new_loc - 1);
 				prev_loc = new_loc;
-				s->cost.team_cost[i] += s->cost.distance[dist];
+				s->cost.team_cost[i] += __Distance(&s->cost, dist);
 			}
 			// add the trip home
 			new_loc = i;
 			int dist = ((prev_loc - 1) * s->num_teams) + (new_loc - 1);
-			s->cost.team_cost[i] += s->cost.distance[dist];
+			s->cost.team_cost[i] += __Distance(&s->cost, dist);
 			// end cost update
 
 			s->cost.total_cost += s->cost.team_cost[i];
-			s->cost.updated[i] = false;
 		}
 	}
+	STAT_INC(s, update_cost.calls);
+	STAT_CYCLES(s, update_cost.cycles, start);
 }
 
-// Initialize the distances and calculate the current cost
-// returns 0 on failure, else a positive value
-unsigned long InitCost(Schedule *s, char *filename) {
-	FILE *fptr = fopen(filename, "r");
-	if (fptr == NULL) {
-		return 0;
-	}
-	// read in costs
-	for (int i = 0; i < s->num_teams * s->num_teams; i++) {
-		if (!fscanf(fptr, "%d ", &(s->cost.distance[i]))) {
-			fclose(fptr);
-			return 0;
+// recount the violations for every team
+void InitViolations(Schedule *s) {
+	int flags;
+	bool simd = SimdViolations(s, s->viol.team_nbv, &flags);
+	s->viol.nbv = 0;
+	for (int i = 1; i <= s->num_teams; i++) {
+		if (!simd) {
+			s->viol.team_nbv[i] = __RangeViolations(s, i, 0, s->num_rounds - 1);
 		}
+		s->viol.nbv += s->viol.team_nbv[i];
+	}
+}
+
+// undo every change made by the current move, newest first
+void Rollback(Schedule *s) {
+	__Rollback(s);
+}
+
+// Read the distances between teams from an instance file
+// returns false on failure, or if the instance has a different number of teams
+bool ReadDistance(Schedule *s, char *filename) {
+	Instance *inst = LoadInstance(filename, false);
+	if (inst == NULL) {
+		return false;
+	}
+	bool retval = inst->num_teams == s->num_teams;
+	if (retval) {
+		memcpy(s->cost.distance, inst->distance, \
+				s->num_teams * s->num_teams * sizeof(*(s->cost.distance)));
+		CompactDistance(s);
+		s->cost.lower_bound = LowerBound(s);
+	}
+	DeleteInstance(inst);
+	return retval;
+}
+
+// Calculate the cost of a complete schedule from its distances
+unsigned long ComputeCost(Schedule *s) {
+	STAT_START(start);
+	if (SimdTourCost(s)) {
+		STAT_INC(s, update_cost.calls);
+		STAT_CYCLES(s, update_cost.cycles, start);
+		return s->cost.total_cost;
 	}
-	fclose(fptr);
-	
 	for (int i = 1; i <= s->num_teams; i++) {
-		s->cost.updated[i] = true;
+		s->cost.dirty[i / 64] |= 1ULL << (i % 64);
 	}
 	UpdateCost(s);
 
 	return s->cost.total_cost;
 }
 
+// Initialize the distances and calculate the current cost
+// returns 0 on failure, else a positive value
+unsigned long InitCost(Schedule *s, char *filename) {
+	if (!ReadDistance(s, filename)) {
+		return 0;
+	}
+	return ComputeCost(s);
+}
+
 // Delete a schedule and free all memory
 void DeleteSchedule(Schedule *s) {
-	free(s->cost.updated);
+	free(s->scratch.mem);
+	free(s->journal.change);
+	free(s->viol.delta);
+	free(s->viol.team_nbv);
+	free(s->cost.delta);
+	free(s->cost.dirty);
 	free(s->cost.team_cost);
-	free(s->cost.distance);
-	for (int i = 0; i < s->num_rounds; i++) {
-		free(s->round[i]->team);
-		free(s->round[i]);
+	if (!s->cost.shared) {
+		free(s->cost.distance);
+	}
+	if (!s->cost.shared16) {
+		free(s->cost.distance16);
 	}
 	free(s->round);
+	free(s->slot);
 	free(s);
 }
 
@@ -222,7 +437,7 @@ void PrintTeamCost(Schedule *s, int t) {
 void PrintSchedule(Schedule *s, const char * const *team_names) {
 	printf("Slot");
 	int num_team_names = 0;
-	while (team_names[num_team_names]) {
+	while (team_names && team_names[num_team_names]) {
 		num_team_names++;
 	}
 	for (int i = 1; i <= s->num_teams; i++) {
@@ -236,42 +451,41 @@ void PrintSchedule(Schedule *s, const char * const *team_names) {
 	for (int j = 0; j < s->num_rounds; j++) {
 		printf("%d", j);
 		for (int i = 1; i <= s->num_teams; i++) {
-			int tmp = s->round[j]->team[i];
+			int tmp = SLOT(s, j, i);
 			if (team_names && abs(tmp) <= num_team_names) {				
 				printf("\t%s%s", (tmp < 0) ? "@" : "", team_names[abs(tmp) - 1]);
 			} else {
-				printf("\t%d", s->round[j]->team[i]);
+				printf("\t%d", SLOT(s, j, i));
 			}
 		}
 		printf("\n");
 	}
 }
 
-
 // Determine if a schedule meets the hard requirements
 // returns 0 if it does, SCHED_INVALID if not
 int CheckHardReq(Schedule *s) {
 #define OPP_POS 0x01
 #define OPP_NEG 0x02
 	int retval = 0;
-	char *opponents = calloc(s->num_teams + 1, sizeof(*opponents));
+	int *opponents = __ScratchGet(s, s->num_teams + 1);
 	// check that every team is played exactly twice
 	for (int i = 1; i <= s->num_teams; i++) {
-		memset(opponents, 0, s->num_teams + 1);
+		memset(opponents, 0, (s->num_teams + 1) * sizeof(*opponents));
 		for (int j = 0; j < s->num_rounds; j++) {
-			if (abs(s->round[j]->team[i]) == i) {
+			if (abs(SLOT(s, j, i)) == i) {
 				retval |= SCHED_INVALID;
 			}
-			if (s->round[j]->team[i] > 0) {
-				int tmp = s->round[j]->team[i];
+			if (SLOT(s, j, i) > 0) {
+				int tmp = SLOT(s, j, i);
 				if (opponents[tmp] & OPP_POS) {
 					retval |= SCHED_INVALID;
 					break;
 				} else {
 					opponents[tmp] |= OPP_POS;
 				}
-			} else if (s->round[j]->team[i] < 0) {
-				int tmp = -s->round[j]->team[i];
+			} else if (SLOT(s, j, i) < 0) {
+				int tmp = -SLOT(s, j, i);
 				if (opponents[tmp] & OPP_NEG) {
 					retval |= SCHED_INVALID;
 					break;
@@ -287,328 +501,704 @@ int CheckHardReq(Schedule *s) {
 			break;
 		}
 	}
-	free(opponents);
+	__ScratchPut(s, s->num_teams + 1);
 	return retval;
 #undef OPP_NEG
 #undef OPP_POS
 }
 
-// Determine if a schedule meets the soft requirements
-// returns 0 if it meets both, SCHED_ATMOST if the atmost contraint fails
-// SCHED_REPEAT if the norepeat contraint fails. These values can OR together
-// takes an optional argument nbv, which is incremented each time a constratin is found
-int CheckSoftReq(Schedule *s, int *nbv) {
+// the scalar scan for CheckSoftReq, the reference for SimdViolations
+// nbv must be NULL or 0
+static int __CheckSoftReq(Schedule *s, int *nbv) {
 	int retval = 0;
-	if (nbv) {
-		*nbv = 0;
-	}
 	// keeps track of number of consecutive games
-	int *atmost_count = calloc(s->num_teams + 1, sizeof(*atmost_count));
+	int *atmost_count = __ScratchGet(s, s->num_teams + 1);
 	// keeps track of location of consectutive games
-	int *atmost_val = calloc(s->num_teams + 1, sizeof(*atmost_val));
+	int *atmost_val = __ScratchGet(s, s->num_teams + 1);
 	// keeps track of last game played
-	int *repeat_val = calloc(s->num_teams + 1, sizeof(*repeat_val));
+	int *repeat_val = __ScratchGet(s, s->num_teams + 1);
 	for (int i = 0; i < s->num_rounds; i++) {
 		for (int j = 1; j <= s->num_teams; j++) {
 			// check atmost
-			if (atmost_val[j] > 0 && s->round[i]->team[j] > 0) {
+			if (atmost_val[j] > 0 && SLOT(s, i, j) > 0) {
 				atmost_count[j]++;
-			} else if (atmost_val[j] < 0 && s->round[i]->team[j] < 0) {
+			} else if (atmost_val[j] < 0 && SLOT(s, i, j) < 0) {
 				atmost_count[j]++;
 			} else {
 				atmost_count[j] = 1;
-				atmost_val[j] = (s->round[i]->team[j] > 0) ? 1 : -1;
+				atmost_val[j] = (SLOT(s, i, j) > 0) ? 1 : -1;
 			}
-			if (atmost_count[j] > 3) {
+			if (atmost_count[j] > ATMOST) {
 				retval |= SCHED_ATMOST;
 				if (nbv) {
 					*nbv += 1;
 				}
 			}
 			// check repeats
-			if (repeat_val[j] == abs(s->round[i]->team[j])) {
+			if (repeat_val[j] == abs(SLOT(s, i, j))) {
 				retval |= SCHED_REPEAT;
 				if (nbv) {
 					*nbv += 1;
 				}
 			}
-			repeat_val[j] = abs(s->round[i]->team[j]);
+			repeat_val[j] = abs(SLOT(s, i, j));
 		}
 	}
-	free(repeat_val);
-	free(atmost_val);
-	free(atmost_count);
+	__ScratchPut(s, 3 * (s->num_teams + 1));
 	return retval;
 }
 
-// Neighborhood functions
-// Swaps the home and away games for team i and j
-static void SwapHomes(Schedule *s, int t_i, int t_j) {
-	int j = 0;
-	for (int i = 0; i < s->num_rounds; i++) {
-		if (abs(s->round[i]->team[t_i]) == t_j) {
-			j++;
-			s->round[i]->team[t_i] *= -1;
-			s->round[i]->team[t_j] *= -1;
-		} 
-		if (j == 2) {
-			break;
+// Determine if a schedule meets the soft requirements
+// returns 0 if it meets both, SCHED_ATMOST if the atmost contraint fails
+// SCHED_REPEAT if the norepeat contraint fails. These values can OR together
+// takes an optional argument nbv, which is incremented each time a constratin is found
+int CheckSoftReq(Schedule *s, int *nbv) {
+	STAT_START(start);
+	int retval = 0;
+	if (nbv) {
+		*nbv = 0;
+	}
+	int *team_nbv = __ScratchGet(s, s->num_teams + 1);
+	if (SimdViolations(s, team_nbv, &retval)) {
+		for (int i = 1; nbv && i <= s->num_teams; i++) {
+			*nbv += team_nbv[i];
 		}
+		__ScratchPut(s, s->num_teams + 1);
+	} else {
+		__ScratchPut(s, s->num_teams + 1);
+		retval = __CheckSoftReq(s, nbv);
 	}
-	s->cost.updated[t_i] = true;
-	s->cost.updated[t_j] = true;
+	STAT_INC(s, check_soft.calls);
+	STAT_CYCLES(s, check_soft.cycles, start);
+	return retval;
 }
 
-// Swaps rounds k and l
-static void SwapRounds(Schedule *s, int r_k, int r_l) {
-	Round *tmp = s->round[r_k];
-	s->round[r_k] = s->round[r_l];
-	s->round[r_l] = tmp;
-	for (int i = 1; i <= s->num_teams; i++) {
-		s->cost.updated[i] = true;
+// Check the vector scans against the scalar ones on s, with each instruction
+// set the CPU supports, printing every difference
+// leaves s with the scalar costs
+// returns false if any differ
+bool CheckScans(Schedule *s) {
+	int n = s->num_teams;
+	bool same = true;
+	unsigned long *team_cost = calloc(n + 1, sizeof(*team_cost));
+	int *team_nbv = calloc(n + 1, sizeof(*team_nbv));
+	int *simd_nbv = calloc(n + 1, sizeof(*simd_nbv));
+	// the scalar scans, the reference
+	s->cost.total_cost = 0;
+	for (int i = 1; i <= n; i++) {
+		s->cost.team_cost[i] = 0;
+		s->cost.dirty[i / 64] |= 1ULL << (i % 64);
+	}
+	UpdateCost(s);
+	unsigned long total_cost = s->cost.total_cost;
+	memcpy(team_cost, s->cost.team_cost, (n + 1) * sizeof(*team_cost));
+	for (int i = 1; i <= n; i++) {
+		team_nbv[i] = __RangeViolations(s, i, 0, s->num_rounds - 1);
+	}
+	int flags = __CheckSoftReq(s, NULL);
+
+	for (int level = SIMD_SSE4; level <= SimdLevel(); level++) {
+		int simd_flags;
+		SimdTourCostAt(s, level);
+		SimdViolationsAt(s, level, simd_nbv, &simd_flags);
+		if (s->cost.total_cost != total_cost) {
+			printf("Error: %s total cost %lu, scalar %lu\n", SIMD_NAMES[level], \
+					s->cost.total_cost, total_cost);
+			same = false;
+		}
+		for (int i = 1; i <= n; i++) {
+			if (s->cost.team_cost[i] != team_cost[i] || simd_nbv[i] != team_nbv[i]) {
+				printf("Error: %s team %d cost %lu violations %d, scalar %lu and %d\n", \
+						SIMD_NAMES[level], i, s->cost.team_cost[i], simd_nbv[i], \
+						team_cost[i], team_nbv[i]);
+				same = false;
+			}
+		}
+		if (simd_flags != flags) {
+			printf("Error: %s soft flags %d, scalar %d\n", SIMD_NAMES[level], \
+					simd_flags, flags);
+			same = false;
+		}
 	}
+
+	s->cost.total_cost = total_cost;
+	memcpy(s->cost.team_cost, team_cost, (n + 1) * sizeof(*team_cost));
+	free(simd_nbv);
+	free(team_nbv);
+	free(team_cost);
+	return same;
 }
 
-// Swaps teams i and j
-static void SwapTeams(Schedule *s, int t_i, int t_j) {
-	for (int i = 0; i < s->num_rounds; i++) {
-		// teams are playing each other, skip
-		if (abs(s->round[i]->team[t_i]) == t_j) {
-			continue;
+// Pick a random move, its teams and rounds are always distinct
+void RandomMove(Schedule *s, Move *m) {
+	__RandomMove(s, m);
+}
+
+// Apply a move, recording it in the journal so it can be rolled back
+void ApplyMove(Schedule *s, Move *m) {
+	__ApplyMove(s, m);
+}
+
+// Work out the change a move would make at weight, leaving s as it is
+void EvaluateMove(Schedule *s, Move *m, int weight, MoveDelta *d) {
+	if (!__EvaluateMove(s, m, d)) {
+		// make it and roll it back, without counting it as a move
+		unsigned long cost = s->cost.total_cost;
+		int nbv = s->viol.nbv;
+		s->journal.num_changes = 0;
+		__MakeMove(s, m);
+		d->cost = s->cost.total_cost - cost;
+		d->nbv = s->viol.nbv - nbv;
+		__Rollback(s);
+	}
+	d->objective = __ProposedObjective(s, weight, d) - __Objective(s, weight, s->viol.nbv);
+}
+
+#ifdef STATS
+// add the counters of src to dst
+static void __AddStats(Stats *dst, Stats *src) {
+	for (int f = 0; f < NUM_MOVES; f++) {
+		dst->move[f].attempts += src->move[f].attempts;
+		dst->move[f].accepts += src->move[f].accepts;
+		dst->move[f].improvements += src->move[f].improvements;
+		dst->move[f].bests += src->move[f].bests;
+		dst->move[f].move_cycles += src->move[f].move_cycles;
+		dst->move[f].rollback_cycles += src->move[f].rollback_cycles;
+	}
+	dst->update_cost.calls += src->update_cost.calls;
+	dst->update_cost.cycles += src->update_cost.cycles;
+	dst->check_soft.calls += src->check_soft.calls;
+	dst->check_soft.cycles += src->check_soft.cycles;
+}
+#endif
+
+static inline double __PerCall(uint64_t cycles, unsigned long calls) {
+	return (calls) ? (double) cycles / calls : 0;
+}
+
+// Print the counters kept when built with STATS
+// cycles are per attempt for moves, per rejection for rollbacks
+void PrintStats(Schedule *s, FILE *f, bool json) {
+	Stats *st = &s->stats;
+#ifndef STATS
+	fprintf(f, (json) ? "{\"stats\": false}\n" : "Built without STATS, no counters kept\n");
+	return;
+#endif
+	if (json) {
+		fprintf(f, "{\n\t\"moves\": {\n");
+	} else {
+		fprintf(f, "%-20s%12s%12s%12s%8s%14s%14s\n", "Move", "Attempts", "Accepts", \
+				"Improved", "Bests", "Cycles/Move", "Cycles/Undo");
+	}
+	for (int i = 0; i < NUM_MOVES; i++) {
+		MoveStats *m = &st->move[i];
+		double move = __PerCall(m->move_cycles, m->attempts);
+		double undo = __PerCall(m->rollback_cycles, m->attempts - m->accepts);
+		if (json) {
+			fprintf(f, "\t\t\"%s\": {\"attempts\": %lu, \"accepts\": %lu, " \
+					"\"improvements\": %lu, \"bests\": %lu, \"move_cycles\": %lu, " \
+					"\"rollback_cycles\": %lu}%s\n", MOVE_NAMES[i], m->attempts, \
+					m->accepts, m->improvements, m->bests, \
+					(unsigned long) m->move_cycles, (unsigned long) m->rollback_cycles, \
+					(i + 1 < NUM_MOVES) ? "," : "");
 		} else {
-			// swap the two teams
-			int tmp = s->round[i]->team[t_i];
-			s->round[i]->team[t_i] = s->round[i]->team[t_j];
-			s->round[i]->team[t_j] = tmp;
-			// update the other teams
-			s->round[i]->team[abs(tmp)] = (tmp > 0) ? -t_j : t_j;
-			tmp = s->round[i]->team[t_i];
-			s->round[i]->team[abs(tmp)] = (tmp > 0) ? -t_i : t_i;
+			fprintf(f, "%-20s%12lu%12lu%12lu%8lu%14.1f%14.1f\n", MOVE_NAMES[i], \
+					m->attempts, m->accepts, m->improvements, m->bests, move, undo);
 		}
 	}
-	for (int i = 1; i <= s->num_teams; i++) {
-		s->cost.updated[i] = true;
+	if (json) {
+		fprintf(f, "\t},\n\t\"UpdateCost\": {\"calls\": %lu, \"cycles\": %lu},\n" \
+				"\t\"CheckSoftReq\": {\"calls\": %lu, \"cycles\": %lu}\n}\n", \
+				st->update_cost.calls, (unsigned long) st->update_cost.cycles, \
+				st->check_soft.calls, (unsigned long) st->check_soft.cycles);
+	} else {
+		fprintf(f, "%-20s%12lu%50.1f\n", "UpdateCost", st->update_cost.calls, \
+				__PerCall(st->update_cost.cycles, st->update_cost.calls));
+		fprintf(f, "%-20s%12lu%50.1f\n", "CheckSoftReq", st->check_soft.calls, \
+				__PerCall(st->check_soft.cycles, st->check_soft.calls));
 	}
 }
 
-// swaps games for a single team at rounds k and l
-static void PartialSwapRounds(Schedule *s, int t_i, int r_k, int r_l) {
-	// get list of teams to swap
-	int *swap = calloc(s->num_teams + 1, sizeof(*swap));
-	int tmp;
-	swap[t_i] = 1;
-	int updated = 1;
-	while (updated) {
-		updated = 0;
-		for (int i = 1; i <= s->num_teams; i++) {
-			if (swap[i]) {
-				tmp = abs(s->round[r_k]->team[i]);
-				if (!swap[tmp]) {
-					swap[tmp] = 1;
-					updated++;
-				} 
-				tmp = abs(s->round[r_l]->team[i]);
-				if (!swap[tmp]) {
-					swap[tmp] = 1;
-					updated++;
-				} 
-			}
+#define CHECKPOINT_MAGIC	0x4b505454	/* "TTPK" */
+#define CHECKPOINT_VERSION	7
+#define CHECKPOINT_ORDER	0x01020304
+
+// Header of a checkpoint, followed by the AnnealState, the current
+// schedule's rng and move count, then the current and best feasible
+// schedules
+// the state and costs are written as they are in memory, so the header
+// records how they are laid out and only a build laying them out the same
+// way resumes it. Games are written as an int each in round order, whatever
+// the Cell size or layout
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	// written as 0x01020304, anything else is from a machine of other endianness
+	uint32_t order;
+	uint32_t num_teams;
+	// of the distances, so a checkpoint is only resumed on its own instance
+	uint32_t hash;
+	// of the costs and move count
+	uint32_t long_size;
+	uint32_t state_size;
+	uint32_t pad;
+} CheckpointHeader;
+
+// FNV-1a of the distances
+static uint32_t __DistanceHash(Schedule *s) {
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < s->num_teams * s->num_teams; i++) {
+		hash = (hash ^ (uint32_t) s->cost.distance[i]) * 16777619u;
+	}
+	return hash;
+}
+
+// the header of a checkpoint of s written by this build
+static void __CheckpointHeader(Schedule *s, CheckpointHeader *h) {
+	memset(h, 0, sizeof(*h));
+	h->magic = CHECKPOINT_MAGIC;
+	h->version = CHECKPOINT_VERSION;
+	h->order = CHECKPOINT_ORDER;
+	h->num_teams = s->num_teams;
+	h->hash = __DistanceHash(s);
+	h->long_size = sizeof(long);
+	h->state_size = sizeof(AnnealState);
+}
+
+// write a schedule's games in round order, with its costs and violations
+static bool __WriteSchedule(Schedule *s, FILE *fptr) {
+	bool ok = fwrite(&s->cost.total_cost, sizeof(s->cost.total_cost), 1, fptr) == 1;
+	ok = ok && fwrite(s->cost.team_cost, sizeof(*(s->cost.team_cost)), \
+			s->num_teams + 1, fptr) == s->num_teams + 1;
+	ok = ok && fwrite(&s->viol.nbv, sizeof(s->viol.nbv), 1, fptr) == 1;
+	ok = ok && fwrite(s->viol.team_nbv, sizeof(*(s->viol.team_nbv)), \
+			s->num_teams + 1, fptr) == s->num_teams + 1;
+	for (int r = 0; ok && r < s->num_rounds; r++) {
+		for (int t = 1; ok && t <= s->num_teams; t++) {
+			// an int per game whatever the size of a Cell
+			int opp = SLOT(s, r, t);
+			ok = fwrite(&opp, sizeof(opp), 1, fptr) == 1;
 		}
 	}
+	return ok;
+}
 
-	// swap all affect teams
-	for (int i = 1; i <= s->num_teams; i++) {
-		if (swap[i]) {
-			tmp = s->round[r_k]->team[i];
-			s->round[r_k]->team[i] = s->round[r_l]->team[i];
-			s->round[r_l]->team[i] = tmp;
-			s->cost.updated[i] = true;
+static bool __ReadSchedule(Schedule *s, FILE *fptr) {
+	bool ok = fread(&s->cost.total_cost, sizeof(s->cost.total_cost), 1, fptr) == 1;
+	ok = ok && fread(s->cost.team_cost, sizeof(*(s->cost.team_cost)), \
+			s->num_teams + 1, fptr) == s->num_teams + 1;
+	ok = ok && fread(&s->viol.nbv, sizeof(s->viol.nbv), 1, fptr) == 1;
+	ok = ok && fread(s->viol.team_nbv, sizeof(*(s->viol.team_nbv)), \
+			s->num_teams + 1, fptr) == s->num_teams + 1;
+	for (int r = 0; ok && r < s->num_rounds; r++) {
+		for (int t = 1; ok && t <= s->num_teams; t++) {
+			int opp;
+			ok = fread(&opp, sizeof(opp), 1, fptr) == 1;
+			SLOT(s, r, t) = opp;
 		}
 	}
-	free(swap);
+	s->set_vals = s->num_rounds * s->num_teams;
+	return ok;
 }
 
-// swaps the games of teams i and j, then updates the schedule
-static void PartialSwapTeams(Schedule *s, int t_i, int t_j, int r_k) {
-	// if trying an invalid swap, just return
-	if (t_i == abs(s->round[r_k]->team[t_j]) ||
-			t_j == abs(s->round[r_k]->team[t_i])) {
-		return;
+// write a checkpoint of an annealing run to filename
+// writes a temporary file and moves it into place, so a kill part way
+// through leaves the last checkpoint intact
+bool WriteCheckpoint(Schedule *sbi, Schedule *sbf, AnnealState *st, \
+		char *filename) {
+	char *tmpname = calloc(strlen(filename) + strlen(".tmp") + 1, sizeof(*tmpname));
+	sprintf(tmpname, "%s.tmp", filename);
+	FILE *fptr = fopen(tmpname, "wb");
+	if (fptr == NULL) {
+		free(tmpname);
+		return false;
 	}
-	// first swap the current round
-	int tmp = s->round[r_k]->team[t_i];
-	s->round[r_k]->team[t_i] = s->round[r_k]->team[t_j];
-	s->round[r_k]->team[t_j] = tmp;
-	// now swap the affected teams in the same round
-	s->round[r_k]->team[abs(tmp)] = (tmp > 0) ? - t_j : t_j;
-	tmp = s->round[r_k]->team[t_i];
-	s->round[r_k]->team[abs(tmp)] = (tmp > 0) ? - t_i : t_i;
-	// update costs:
-	s->cost.updated[t_i] = true;
-	s->cost.updated[t_j] = true;
-	s->cost.updated[abs(s->round[r_k]->team[t_i])] = true;
-	s->cost.updated[abs(s->round[r_k]->team[t_j])] = true;
-	// now run recursively on any affected rounds
-	for (int i = 0; i < s->num_rounds; i++) {
-		if (i == r_k) {
-			continue;
-		}
-		if (s->round[r_k]->team[t_i] == s->round[i]->team[t_i] ||
-			s->round[r_k]->team[t_j] == s->round[i]->team[t_j]) {
-			PartialSwapTeams(s, t_i, t_j, i);
-		}
-		int t1 = abs(s->round[r_k]->team[t_i]);
-		int t2 = abs(s->round[r_k]->team[t_j]);
-		if (s->round[r_k]->team[t1] == s->round[i]->team[t1] ||
-			s->round[r_k]->team[t2] == s->round[i]->team[t2]) {
-			PartialSwapTeams(s, t1, t2, i);
-		}
+	CheckpointHeader h;
+	__CheckpointHeader(sbi, &h);
+	bool ok = fwrite(&h, sizeof(h), 1, fptr) == 1;
+	ok = ok && fwrite(st, sizeof(*st), 1, fptr) == 1;
+	ok = ok && fwrite(&sbi->rng, sizeof(sbi->rng), 1, fptr) == 1;
+	ok = ok && fwrite(&sbi->num_moves, sizeof(sbi->num_moves), 1, fptr) == 1;
+	ok = ok && __WriteSchedule(sbi, fptr) && __WriteSchedule(sbf, fptr);
+	ok &= !fclose(fptr);
+	ok = ok && !rename(tmpname, filename);
+	if (!ok) {
+		unlink(tmpname);
 	}
+	free(tmpname);
+	return ok;
 }
 
-static double __Sublinear(int v) {
-	return 1 + (sqrt(v) * log(v) / 2);
+// read a checkpoint for sbi's instance written by WriteCheckpoint, in a
+// build with the same layout
+static bool ReadCheckpoint(Schedule *sbi, Schedule *sbf, AnnealState *st, \
+		char *filename) {
+	FILE *fptr = fopen(filename, "rb");
+	if (fptr == NULL) {
+		return false;
+	}
+	CheckpointHeader h, want;
+	__CheckpointHeader(sbi, &want);
+	bool ok = fread(&h, sizeof(h), 1, fptr) == 1 && !memcmp(&h, &want, sizeof(h));
+	ok = ok && fread(st, sizeof(*st), 1, fptr) == 1;
+	ok = ok && fread(&sbi->rng, sizeof(sbi->rng), 1, fptr) == 1;
+	ok = ok && fread(&sbi->num_moves, sizeof(sbi->num_moves), 1, fptr) == 1;
+	ok = ok && __ReadSchedule(sbi, fptr) && __ReadSchedule(sbf, fptr);
+	fclose(fptr);
+	return ok;
 }
 
-// Objective function
-static double __Objective(Schedule *s, int weight, int nbv) {
-	if (nbv) {
-		double tmp = weight * __Sublinear(nbv);
-		return sqrt((double) (s->cost.total_cost * s->cost.total_cost) + (tmp * tmp));
+// annealing cores compiled for fixed team counts, NULL for the rest
+static void (*const ANNEAL_FIXED[])(Schedule *sbi, Schedule *sbf, AnnealState *st) = {
+#define ANNEAL_FIXED_ENTRY(n)	[n] = AnnealFixed##n,
+	FIXED_TEAM_COUNTS(ANNEAL_FIXED_ENTRY)
+#undef ANNEAL_FIXED_ENTRY
+};
+
+// anneal sbi from state st, keeping the best feasible schedule in sbf
+// with the core compiled for its team count if there is one
+static void __Anneal(Schedule *sbi, Schedule *sbf, AnnealState *st) {
+	int n = sbi->num_teams;
+	if (n < sizeof(ANNEAL_FIXED) / sizeof(*ANNEAL_FIXED) && ANNEAL_FIXED[n]) {
+		ANNEAL_FIXED[n](sbi, sbf, st);
 	} else {
-		return (double) s->cost.total_cost;
-	}
-}
-
-static void __DoRandomChange(Schedule *s, bool undo) {
-	// teams
-	static int t_i = 1; static int t_j = 1;
-	// rounds
-	static int r_k = 0;	static int r_l = 0;
-	// function
-	static int f = 0;
-
-	if (!undo) {
-		t_i = (rand() % s->num_teams) + 1;
-		do {
-			t_j = (rand() % s->num_teams) + 1;
-		} while (t_j == t_i);
-		r_k = rand() % s->num_rounds;
-		do {
-			r_l = rand() % s->num_rounds;
-		} while (r_l == r_k);
-		f = rand() % 5;
-	}
-	switch(f) {
-		case 0:
-			SwapHomes(s, t_i, t_j);
-			break;
-		case 1:
-			SwapRounds(s, r_k, r_l);
-			break;
-		case 2:
-			SwapTeams(s, t_i, t_j);
-			break;
-		case 3:
-			PartialSwapRounds(s, t_i, r_k, r_l);
-			break;
-		case 4:
-			PartialSwapTeams(s, t_i, t_j, r_l);
-			break;
+		__AnnealCore(sbi, sbf, st);
 	}
-	UpdateCost(s);
 }
 
-#define UL_INF ((unsigned long) ~0)
-
 // Runs the simulated annealing algorithm for a given temperature and beta
 // requires initial schedule with initial cost
 // Best feasible is stored in s
 void Anneal(Schedule *sbi, Settings settings) {
 	// best feasible so far
-	Schedule *sbf = CreateSchedule(sbi->num_teams);
-	if (!CheckSoftReq(sbi, NULL)) {
+	Schedule *sbf = CloneSchedule(sbi);
+	InitViolations(sbi);
+	if (!sbi->viol.nbv) {
 		CopySchedule(sbf, sbi, false);
 	} else {
 		sbf->cost.total_cost = UL_INF;
 	}
-	double best_feasible = DBL_MAX, nbf = DBL_MAX;
-	double best_infeasible = DBL_MAX, nbi = DBL_MAX;
-	int best_temp = 0;
-	int reheat = 0;
-	int nbv;
-	double total_cycles = (settings.max_reheat + 1) * (settings.max_phase + 1) \
-			* (settings.max_counter + 1);
-	double num_cycles = 0;
+	AnnealState st;
+	memset(&st, 0, sizeof(st));
+	st.settings = settings;
+	st.best_feasible = st.nbf = DBL_MAX;
+	st.best_infeasible = st.nbi = DBL_MAX;
+	__InitPolicy(&st.policy);
+	// objective of the current state, only changes when a move is accepted
+	// or the weight changes
+	st.old_cost = __Objective(sbi, settings.weight, sbi->viol.nbv);
+	__Anneal(sbi, sbf, &st);
+	DeleteSchedule(sbf);
+}
+
+// A single chain of parallel tempering, running at a fixed temperature
+typedef struct {
+	struct Tempering *pt;
+	pthread_t thread;
+	Schedule *s;
+	Schedule *sbf;
+	double temp;
+	double weight;
+	double cost;
+	double best_feasible;
+	double best_infeasible;
+	bool improved;
+	// each chain learns its own, as the moves that pay differ with temperature
+	MovePolicy policy;
+	// only the coldest chain is traced, NULL for the rest
+	Trace *trace;
+	unsigned long next_sample;
+} Replica;
+
+// State shared by all the chains of a parallel tempering run
+typedef struct Tempering {
+	Replica *replica;
+	int num_replicas;
+	Settings settings;
+	pthread_barrier_t barrier;
+	// chains wait for ready until every one has a thread, and don't run at
+	// all if one couldn't get one
+	pthread_mutex_t start_lock;
+	pthread_cond_t started;
+	bool ready;
+	unsigned round;
+	unsigned phase;
+	bool done;
+	double start;
+	// when to stop, 0 for no limit
+	double deadline;
+	// best feasible cost of any chain so far
+	double best_feasible;
+	// best feasible cost to stop at
+	double target;
+} Tempering;
+
+// one step of a chain, a random move accepted by the Metropolis criterion
+static void __TemperStep(Replica *r) {
+	Schedule *s = r->s;
+	Settings *settings = &r->pt->settings;
+	MovePolicy *policy = (settings->policy == POLICY_ADAPTIVE) ? &r->policy : NULL;
+	if (r->trace && s->num_moves >= r->next_sample) {
+		TraceSample sample = {__Seconds() - r->pt->start, s->num_moves, r->temp, r->weight, \
+				r->cost, s->viol.nbv, 0, r->best_feasible, r->best_infeasible};
+		TraceRecord(r->trace, &sample);
+		r->next_sample = s->num_moves + settings->trace_every;
+	}
+	Move m;
+	MoveDelta d;
+	double start = __PolicyStart(policy);
+	bool made = __ProposeMove(s, policy, &m, &d);
+	int nbv = s->viol.nbv + d.nbv;
+	double new_cost = __ProposedObjective(s, r->weight, &d);
+	if (new_cost >= r->cost && !__Chance(s, exp((r->cost - new_cost) / r->temp))) {
+		__RejectMove(s, &m, made);
+		__PolicyRecord(policy, m.type, 0, start);
+		return;
+	}
+	__AcceptMove(s, &m, made);
+	__PolicyRecord(policy, m.type, r->cost - new_cost, start);
+	STAT_INC(s, move[m.type].accepts);
+	if (new_cost < r->cost) {
+		STAT_INC(s, move[m.type].improvements);
+	}
+	if (nbv == 0 && new_cost < r->best_feasible) {
+		STAT_INC(s, move[m.type].bests);
+		r->best_feasible = new_cost;
+		CopySchedule(r->sbf, s, false);
+		r->weight = r->weight / settings->theta;
+		r->improved = true;
+		new_cost = __Objective(s, r->weight, nbv);
+	} else if (nbv > 0 && new_cost < r->best_infeasible) {
+		STAT_INC(s, move[m.type].bests);
+		r->best_infeasible = new_cost;
+		r->weight = r->weight * settings->delta;
+		r->improved = true;
+		new_cost = __Objective(s, r->weight, nbv);
+	}
+	r->cost = new_cost;
+}
+
+// try to swap the states of neighboring chains a and b
+static void __TemperExchange(Replica *a, Replica *b) {
+	Schedule *x = a->s, *y = b->s;
+	double before = __Objective(x, a->weight, x->viol.nbv) / a->temp +
+			__Objective(y, b->weight, y->viol.nbv) / b->temp;
+	double after = __Objective(y, a->weight, y->viol.nbv) / a->temp +
+			__Objective(x, b->weight, x->viol.nbv) / b->temp;
+	if (after > before && !__Chance(a->pt->replica[0].s, exp(before - after))) {
+		return;
+	}
+	a->s = y;
+	b->s = x;
+	a->cost = __Objective(a->s, a->weight, a->s->viol.nbv);
+	b->cost = __Objective(b->s, b->weight, b->s->viol.nbv);
+}
+
+// run between rounds by a single thread, exchanges states and checks if done
+static void __TemperRound(Tempering *pt) {
+	bool improved = false;
+	double best_feasible = pt->best_feasible;
+	for (int i = 0; i < pt->num_replicas; i++) {
+		improved |= pt->replica[i].improved;
+		pt->replica[i].improved = false;
+		if (pt->replica[i].best_feasible < best_feasible) {
+			best_feasible = pt->replica[i].best_feasible;
+		}
+	}
+	if (improved) {
+		pt->phase = 0;
+	} else {
+		pt->phase++;
+	}
+	bool stopped = best_feasible < pt->best_feasible && !__Progress(&pt->settings, \
+			(unsigned long) best_feasible, __Seconds() - pt->start);
+	pt->best_feasible = best_feasible;
+	pt->done = stopped || pt->phase > pt->settings.max_phase || \
+			best_feasible <= pt->target || (pt->deadline && __Seconds() >= pt->deadline);
+	// alternate between even and odd pairs
+	for (int i = pt->round % 2; i + 1 < pt->num_replicas; i += 2) {
+		__TemperExchange(&pt->replica[i], &pt->replica[i + 1]);
+	}
+	pt->round++;
+	if (pt->settings.update) {
+		printf("\r%.2f%%\t\t\t", ((double) pt->phase / (pt->settings.max_phase + 1)) * 100.00);
+	}
+}
+
+// thread for a single chain
+static void *__TemperChain(void *arg) {
+	Replica *r = arg;
+	Tempering *pt = r->pt;
+	pthread_mutex_lock(&pt->start_lock);
+	while (!pt->ready) {
+		pthread_cond_wait(&pt->started, &pt->start_lock);
+	}
+	pthread_mutex_unlock(&pt->start_lock);
+	while (!pt->done) {
+		for (int counter = 0; counter <= pt->settings.max_counter; counter++) {
+			__TemperStep(r);
+		}
+		if (pthread_barrier_wait(&pt->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+			__TemperRound(pt);
+		}
+		pthread_barrier_wait(&pt->barrier);
+	}
+	return NULL;
+}
+
+// Runs parallel tempering with num_replicas chains, each on its own thread
+// The chains run at fixed temperatures spaced geometrically from the starting
+// temperature down to where annealing would be after max_phase phases.
+// Every max_counter steps neighboring chains try to swap states, and the run
+// stops after max_phase rounds without a new best, at the first round past
+// the time limit, or once the best is within the gap. max_reheat is unused.
+// requires initial schedule with initial cost
+// Best feasible is stored in s
+// returns false, leaving s as it was, if a thread couldn't be started for
+// every chain
+bool Temper(Schedule *s, int num_replicas, Settings settings) {
+	Tempering pt;
+	pt.replica = calloc(num_replicas, sizeof(*(pt.replica)));
+	pt.num_replicas = num_replicas;
+	pt.settings = settings;
+	pt.round = 0;
+	pt.phase = 0;
+	pt.done = false;
+	pt.start = __Seconds();
+	pt.deadline = (settings.time_limit > 0) ? pt.start + settings.time_limit : 0;
+	pt.best_feasible = DBL_MAX;
+	pt.target = __GapTarget(s, &settings);
+	pthread_barrier_init(&pt.barrier, NULL, num_replicas);
+	pthread_mutex_init(&pt.start_lock, NULL);
+	pthread_cond_init(&pt.started, NULL);
+	pt.ready = false;
+
+	InitViolations(s);
+	double coldest = pow(settings.beta, settings.max_phase);
+	for (int i = 0; i < num_replicas; i++) {
+		Replica *r = &pt.replica[i];
+		r->pt = &pt;
+		r->s = CloneSchedule(s);
+		r->sbf = CloneSchedule(s);
+		CopySchedule(r->s, s, false);
+		SeedSchedule(r->s, __Rand(s));
+		r->temp = settings.temp;
+		if (num_replicas > 1) {
+			r->temp *= pow(coldest, (double) i / (num_replicas - 1));
+		}
+		r->weight = settings.weight;
+		r->cost = __Objective(r->s, r->weight, r->s->viol.nbv);
+		r->best_feasible = DBL_MAX;
+		r->best_infeasible = DBL_MAX;
+		r->improved = false;
+		__InitPolicy(&r->policy);
+		r->trace = (i == num_replicas - 1) ? settings.trace : NULL;
+		r->next_sample = 0;
+		if (!s->viol.nbv) {
+			CopySchedule(r->sbf, s, false);
+		}
+	}
 	if (settings.update) {
 		printf("Percentage complete:\n%.2f", 0.0);
 	}
-	while (reheat <= settings.max_reheat) {
-		int phase = 0;
-		while (phase <= settings.max_phase) {
-			int counter = 0;
-			while (counter <= settings.max_counter) {
-				bool accept;
-				CheckSoftReq(sbi, &nbv);
-				double old_cost = __Objective(sbi, settings.weight, nbv);
-				__DoRandomChange(sbi, false);
-				CheckSoftReq(sbi, &nbv);
-				double new_cost = __Objective(sbi, settings.weight, nbv);
-
-				if ((new_cost < old_cost) || 
-						(nbv == 0 && new_cost < best_feasible) || 
-						(nbv > 0 && new_cost < best_infeasible)) {
-					accept = true;
-				} else if (exp((old_cost - new_cost) / settings.temp)) {
-					accept = true;
-				} else {
-					accept = false;
-				}
-				if (accept) {
-					if (nbv == 0) {
-						nbf = (new_cost < best_feasible) ? 
-								new_cost : best_feasible;
-						if (nbf < best_feasible) {
-							sbf->cost.total_cost = (unsigned long) new_cost;
-							CopySchedule(sbf, sbi, false);
-						}
-					} else {
-						nbi = (new_cost < best_infeasible) ? 
-								new_cost : best_infeasible;
-					}
-					if (nbf < best_feasible || nbi < best_infeasible) {
-						reheat = 0; counter = 0; phase = 0; num_cycles = 0;
-						best_temp = settings.temp;
-						best_feasible = nbf;
-						best_infeasible = nbi;
-						if (nbv == 0) {
-							settings.weight = settings.weight / settings.theta;
-						} else {
-							settings.weight = settings.weight * settings.delta;
-						}
-					} else {
-						counter++;
-						num_cycles++;
-					}
-				} else {
-					// undo the change
-					__DoRandomChange(sbi, true);
-				}
-			} // counter
-			phase++;
-			if (settings.update) {
-				printf("\r%.2f%%\t\t\t", (num_cycles / total_cycles) * 100.00);
-			}
-			settings.temp = settings.temp * settings.beta;
-		} // phase
-		reheat++;
-		settings.temp = 2 * best_temp;
-	} // reheat
+	int started;
+	for (started = 0; started < num_replicas; started++) {
+		if (pthread_create(&pt.replica[started].thread, NULL, __TemperChain, \
+				&pt.replica[started])) {
+			break;
+		}
+	}
+	// a chain short and the barrier would never open, so none run
+	bool ran = started == num_replicas;
+	pthread_mutex_lock(&pt.start_lock);
+	pt.done = !ran;
+	pt.ready = true;
+	pthread_cond_broadcast(&pt.started);
+	pthread_mutex_unlock(&pt.start_lock);
+	for (int i = 0; i < started; i++) {
+		pthread_join(pt.replica[i].thread, NULL);
+	}
 	if (settings.update) {
 		printf("\n");
 	}
-	if (!CheckHardReq(sbf)) {
-		CopySchedule(sbi, sbf, true);
+
+	// keep the best feasible schedule of any chain, else the coldest state
+	if (ran) {
+		Schedule *best = NULL;
+		for (int i = 0; i < num_replicas; i++) {
+			Schedule *sbf = pt.replica[i].sbf;
+			if (CheckHardReq(sbf)) {
+				continue;
+			}
+			if (!best || sbf->cost.total_cost < best->cost.total_cost) {
+				best = sbf;
+			}
+		}
+		if (!best) {
+			best = pt.replica[num_replicas - 1].s;
+		}
+		CopySchedule(s, best, false);
+	}
+
+	for (int i = 0; i < num_replicas; i++) {
+		s->num_moves += pt.replica[i].s->num_moves;
+#ifdef STATS
+		__AddStats(&s->stats, &pt.replica[i].s->stats);
+#endif
+		DeleteSchedule(pt.replica[i].sbf);
+		DeleteSchedule(pt.replica[i].s);
+	}
+	pthread_barrier_destroy(&pt.barrier);
+	pthread_mutex_destroy(&pt.start_lock);
+	pthread_cond_destroy(&pt.started);
+	free(pt.replica);
+	return ran;
+}
+
+// Generate a schedule for s from seed, then anneal or temper it
+// s must have its distances but no games set
+// returns SCHED_GENERATE if no valid schedule could be generated,
+// SCHED_THREAD if tempering couldn't start its threads, else the result of
+// checking the requirements of the final schedule
+int Solve(Schedule *s, unsigned seed, Settings settings) {
+	SeedSchedule(s, seed);
+	if (!StartSchedule(s, settings.generator) || CheckHardReq(s)) {
+		return SCHED_GENERATE;
+	}
+	ComputeCost(s);
+
+	if (settings.replicas) {
+		if (!Temper(s, settings.replicas, settings)) {
+			return SCHED_THREAD;
+		}
+	} else {
+		Anneal(s, settings);
 	}
+	return CheckHardReq(s) | CheckSoftReq(s, NULL);
+}
+
+// Carry on annealing s from a checkpoint written while annealing its instance
+// settings only gives where to checkpoint, the time limit, the gap, what to
+// print, progress and the trace, the rest is as it was in the checkpoint
+// returns SCHED_RESUME if the checkpoint could not be read, else the result
+// of checking the requirements of the final schedule
+int Resume(Schedule *s, char *filename, Settings settings) {
+	Schedule *sbf = CloneSchedule(s);
+	AnnealState st;
+	if (!ReadCheckpoint(s, sbf, &st, filename)) {
+		DeleteSchedule(sbf);
+		return SCHED_RESUME;
+	}
+	st.settings.update = settings.update;
+	st.settings.checkpoint = settings.checkpoint;
+	st.settings.checkpoint_every = settings.checkpoint_every;
+	st.settings.time_limit = settings.time_limit;
+	st.settings.progress = settings.progress;
+	st.settings.progress_data = settings.progress_data;
+	st.settings.gap = settings.gap;
+	st.settings.trace = settings.trace;
+	st.settings.trace_every = settings.trace_every;
+	__Anneal(s, sbf, &st);
 	DeleteSchedule(sbf);
-}
\ No newline at end of file
+	return CheckHardReq(s) | CheckSoftReq(s, NULL);
+}
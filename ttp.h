@@ -3,39 +3,200 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdbool.h>
 
-// Team names
-static const char *const TEAM_NAMES[] = {
-		"ATL","NYM","PHI","MON",\
-		"FLA","PIT","CIN","CHI",\
-		"STL","MIL","HOU","COL",\
-		"SF", "SD", "LA", "ARI", 0
-};
-
-// Array of who each team is playing for a given week
-// Teams start at 1, team 0 is unused
-typedef struct {
-	int *team;
-} Round;
-
 typedef struct {
 	unsigned long *team_cost;
 	int *distance;
+	// the same distances in 16 bits, if they all fit, else NULL
+	// half the size, so more of it stays in cache
+	uint16_t *distance16;
 	unsigned long total_cost;
-	bool *updated;
+	// no schedule of these distances costs less, 0 if it isn't known
+	unsigned long lower_bound;
+	// distance belongs to another schedule
+	bool shared;
+	// distance16 belongs to another schedule
+	bool shared16;
+	// bitset of the teams whose cost needs updating
+	uint64_t *dirty;
+	// scratch space for per team cost deltas of a move
+	long *delta;
 } Cost;
 
-// Array of pointers to weeks. Allows for swapping weeks quickly
-// weeks start at 0
+// distance i of the cost table, from the 16 bit copy if there is one
+static inline int __Distance(const Cost *c, int i) {
+	return (c->distance16) ? c->distance16[i] : c->distance[i];
+}
+
+// Number of soft constraint violations, kept up to date by the moves
+typedef struct {
+	int *team_nbv;
+	int nbv;
+	// scratch space for per team violation deltas of a move
+	int *delta;
+} Violations;
+
+// A single write made by a move
+// team 0 marks that rounds round and val were swapped
+// round -1 marks a cost change without a write
+typedef struct {
+	int round;
+	int team;
+	int val;
+	long cost;
+	int nbv;
+} Change;
+
+// Changes made by the current move, in order, so it can be rolled back
+typedef struct {
+	Change *change;
+	int num_changes;
+	int max_changes;
+} Journal;
+
+// Scratch memory for the neighborhood and check functions, used as a stack
+// so nothing is allocated while annealing
+typedef struct {
+	int *mem;
+	int size;
+	int used;
+} Scratch;
+
+// Neighborhood moves
+enum {MOVE_SWAP_HOMES, MOVE_SWAP_ROUNDS, MOVE_SWAP_TEAMS, MOVE_PARTIAL_SWAP_ROUNDS, \
+		MOVE_PARTIAL_SWAP_TEAMS, NUM_MOVES};
+
+static const char *const MOVE_NAMES[] = {
+		"SwapHomes", "SwapRounds", "SwapTeams", \
+		"PartialSwapRounds", "PartialSwapTeams", 0
+};
+
+typedef struct {
+	int type;
+	int t_i;
+	int t_j;
+	int r_k;
+	int r_l;
+} Move;
+
+// Change a move makes to the travel distance, the number of soft
+// constraint violations and the objective
+typedef struct {
+	long cost;
+	int nbv;
+	double objective;
+} MoveDelta;
+
+// Counters for a single type of move, only kept when built with STATS
+typedef struct {
+	unsigned long attempts;
+	unsigned long accepts;
+	unsigned long improvements;
+	unsigned long bests;
+	uint64_t move_cycles;
+	uint64_t rollback_cycles;
+} MoveStats;
+
+// Counters for calls to a full scan, only kept when built with STATS
+typedef struct {
+	unsigned long calls;
+	uint64_t cycles;
+} ScanStats;
+
+typedef struct {
+	MoveStats move[NUM_MOVES];
+	ScanStats update_cost;
+	ScanStats check_soft;
+} Stats;
+
+// Random number generator state, one per schedule so runs are independent
+typedef struct {
+	uint64_t state;
+	uint64_t inc;
+} Rng;
+
+// next random number from a PCG32 generator
+static inline uint32_t __NextRand(Rng *rng) {
+	uint64_t old = rng->state;
+	rng->state = old * 6364136223846793005ULL + rng->inc;
+	uint32_t xorshifted = ((old >> 18) ^ old) >> 27;
+	uint32_t rot = old >> 59;
+	return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+// A single opponent in the schedule, negative if away
+// 8 bits holds up to MAX_TEAMS teams, build with WIDE_CELLS for more
+#ifdef WIDE_CELLS
+typedef int16_t Cell;
+#define MAX_TEAMS		32766
+#else
+typedef int8_t Cell;
+#define MAX_TEAMS		126
+#endif
+
+// Who each team is playing for each week, stored in one contiguous block
+// Teams start at 1, team 0 is unused. Weeks start at 0
+// round maps each week to its row (or column) in slot, so weeks can be
+// swapped quickly
 typedef struct {
 	int num_teams;
 	int num_rounds;
 	int set_vals;
 	Cost cost;
-	Round **round;
+	Violations viol;
+	Journal journal;
+	Scratch scratch;
+	Rng rng;
+	// moves made on this schedule so far
+	unsigned long num_moves;
+	Stats stats;
+	int stride;
+	int *round;
+	Cell *slot;
 } Schedule;
 
+// most consecutive home or away games allowed
+#define ATMOST			3
+
+#define CACHE_LINE		64
+#define CACHE_LINE_CELLS	(CACHE_LINE / sizeof(Cell))
+
+// Opponent of team t in round r, negative if away
+// Build with TEAM_MAJOR to keep each team's tour together instead of each round
+#ifdef TEAM_MAJOR
+#define ROW_LEN(s)		((s)->num_rounds)
+#define NUM_ROWS(s)		((s)->num_teams + 1)
+#define SLOT(s, r, t)	((s)->slot[((t) * (s)->stride) + (s)->round[(r)]])
+#else
+#define ROW_LEN(s)		((s)->num_teams + 1)
+#define NUM_ROWS(s)		((s)->num_rounds)
+#define SLOT(s, r, t)	((s)->slot[((s)->round[(r)] * (s)->stride) + (t)])
+#endif
+
+// starting schedule generators
+// GEN_AUTO backtracks for up to BACKTRACK_MAX_TEAMS teams, where it is fast,
+// and uses the circle method above that
+enum {GEN_AUTO, GEN_BACKTRACK, GEN_CIRCLE};
+#define BACKTRACK_MAX_TEAMS	32
+
+// how each move is picked
+// POLICY_ADAPTIVE favours the moves that have improved the objective most
+// per nanosecond spent on them, so runs are no longer repeatable by seed
+enum {POLICY_UNIFORM, POLICY_ADAPTIVE};
+
+// Called with each new best feasible cost and the seconds since solving
+// started, solving stops early if it returns false
+// Tempering calls it from whichever chain's thread finishes a round
+typedef bool (*Progress)(void *data, unsigned long cost, double seconds);
+
+// most chains parallel tempering runs, each takes a thread
+#define MAX_REPLICAS	64
+
+// convergence trace of a run, see trace.h
+typedef struct Trace Trace;
+
 // settings for simulated annealing
 typedef struct {
 	double temp;
@@ -46,11 +207,42 @@ typedef struct {
 	unsigned max_reheat;
 	unsigned max_phase;
 	unsigned max_counter;
+	// number of chains for parallel tempering, 0 to anneal, at most
+	// MAX_REPLICAS
+	unsigned replicas;
+	// how to generate the starting schedule
+	int generator;
+	// how to pick moves
+	int policy;
 	bool update;
+	// file annealing is checkpointed to, NULL for none
+	char *checkpoint;
+	// seconds between checkpoints
+	unsigned checkpoint_every;
+	// seconds to anneal for before stopping early, 0 for no limit
+	double time_limit;
+	// told of each new best feasible cost, NULL for none
+	Progress progress;
+	void *progress_data;
+	// samples of the run are recorded to, NULL for none
+	Trace *trace;
+	// moves between samples
+	unsigned trace_every;
+	// percent above the lower bound to stop at once a feasible schedule is
+	// found within it, 0 to stop only at the lower bound itself
+	double gap;
 } Settings;
 
 Schedule *CreateSchedule(int num_teams);
+Schedule *CreateScheduleShared(int num_teams, int *distance);
+Schedule *CloneSchedule(Schedule *s);
+void SeedRng(Rng *rng, unsigned seed);
+void SeedSchedule(Schedule *s, unsigned seed);
 bool GenerateSchedule(Schedule *s);
+bool CircleSchedule(Schedule *s);
+bool StartSchedule(Schedule *s, int generator);
+bool ReadDistance(Schedule *s, char *filename);
+unsigned long ComputeCost(Schedule *s);
 unsigned long InitCost(Schedule *s, char *filename);
 void DeleteSchedule(Schedule *s);
 void PrintTeamCost(Schedule *s, int t);
@@ -60,8 +252,77 @@ int CheckHardReq(Schedule *s);
 #define SCHED_ATMOST	0x02
 #define SCHED_REPEAT	0x04
 int CheckSoftReq(Schedule *s, int *nbv);
+// Check the SIMD scans against the scalar ones on s, see simd.h
+// returns false, printing the differences, if any differ
+bool CheckScans(Schedule *s);
+#define SCHED_GENERATE	0x08
+#define SCHED_THREAD	0x20
+int Solve(Schedule *s, unsigned seed, Settings settings);
+#define SCHED_RESUME	0x10
+int Resume(Schedule *s, char *filename, Settings settings);
+
+void RandomMove(Schedule *s, Move *m);
+void ApplyMove(Schedule *s, Move *m);
+// Work out the change move m would make at weight into d, without making it
+void EvaluateMove(Schedule *s, Move *m, int weight, MoveDelta *d);
+void Rollback(Schedule *s);
+void InitViolations(Schedule *s);
+// Print the counters kept when built with STATS, as a table or as JSON
+void PrintStats(Schedule *s, FILE *f, bool json);
 
 // Annealing algorithm
+// checkpoints to settings.checkpoint every settings.checkpoint_every seconds
+// if it is set, and stops after settings.time_limit seconds if it is set, or
+// once the best feasible cost is within settings.gap percent of the lower bound
 void Anneal(Schedule *s, Settings settings);
+// Parallel tempering, num_replicas chains each on their own thread
+// returns false, leaving s as it was, if a thread couldn't be started for
+// every chain
+bool Temper(Schedule *s, int num_replicas, Settings settings);
+
+// Embedding API, the library built as libttp.a and libttp.so
+// A context is a single instance and the result of the last solve of it.
+// Nothing is shared between contexts besides the distances, which are only
+// read, so each context can be used on a thread of its own, though a single
+// context must only be used by one thread at a time.
+typedef struct TtpContext TtpContext;
+
+// Fill settings with the defaults rdb-ttp uses
+void TtpDefaultSettings(Settings *settings);
+// Load the instance in filename, a text file or binary cache, using a
+// binary cache next to it if cache is set, see LoadInstance
+// returns NULL if it can't be read or hasn't an even number of teams from
+// 4 to MAX_TEAMS
+TtpContext *TtpLoad(char *filename, bool cache);
+// A context for num_teams teams with num_teams * num_teams distances, from
+// team i to j at (i * num_teams) + j, and optionally names, one per team
+// The distances and names are shared, and must outlive the context
+TtpContext *TtpCreate(int num_teams, int *distance, const char *const *names);
+// A context for the same instance as ctx, which must outlive it
+TtpContext *TtpClone(TtpContext *ctx);
+void TtpDelete(TtpContext *ctx);
+// Solve ctx's instance from seed, telling progress of each new best if it
+// isn't NULL, replacing the last result
+// returns 0 if the schedule found is valid, else the SCHED_ flags of what is
+// wrong with it
+int TtpSolve(TtpContext *ctx, unsigned seed, const Settings *settings, \
+		Progress progress, void *data);
+// Carry on from a checkpoint instead, as Resume
+int TtpResume(TtpContext *ctx, char *filename, const Settings *settings, \
+		Progress progress, void *data);
+int TtpNumTeams(TtpContext *ctx);
+int TtpNumRounds(TtpContext *ctx);
+// name of team t from 1, NULL if the teams are unnamed
+const char *TtpTeamName(TtpContext *ctx, int t);
+// lower bound on the cost of any schedule of ctx's instance
+unsigned long TtpLowerBound(TtpContext *ctx);
+// cost of the last result, 0 before the first solve
+unsigned long TtpCost(TtpContext *ctx);
+// opponent of team t from 1 in round r from 0 of the last result, negative
+// if away, 0 before the first solve
+int TtpOpponent(TtpContext *ctx, int r, int t);
+// the last result, for PrintSchedule and PrintStats, NULL before the first
+// solve
+Schedule *TtpSchedule(TtpContext *ctx);
 
 #endif /* TTP_H */
\ No newline at end of file